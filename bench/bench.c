@@ -0,0 +1,278 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm.h"
+#include "handlers.h"
+#include "clock.h"
+#include "synth.h"
+#include "roms.h"
+
+/*
+ * Benchmarks: chip8-bench [--reps <n>] [--json] [name...]
+ *
+ * Micro benchmarks call single handlers and the presentation and audio paths directly, macro
+ * benchmarks run small ROMs through VM_exec for a fixed instruction count. Every benchmark runs
+ * once to warm up and then `reps` times, and the median, minimum and standard deviation of the
+ * time per unit (an instruction, a handler call, a frame or a sample) are reported. Names given
+ * on the command line select the benchmarks whose names contain them.
+ */
+
+#define DEFAULT_REPS 11
+#define SAMPLE_RATE 44100
+#define AUDIO_BUFFER 512
+
+typedef struct {
+    VM* vm;
+    PixelLUT lut;
+    uint32_t pixels[SCREEN_HEIGHT * SCREEN_WIDTH];
+    Synth synth;
+    int16_t samples[AUDIO_BUFFER];
+} Context;
+
+typedef struct {
+    const char* name;
+    const char* unit;
+    uint64_t units;                              // per repetition
+    void (*setup)(Context* ctx, const void* arg);  // NULL if there's nothing to prepare
+    void (*run)(Context* ctx, const void* arg, uint64_t units);
+    const void* arg;
+} Benchmark;
+
+// Handler benchmarks start from a VM with the font at 0 and I pointing at it
+
+static void setup_handler(Context* ctx, const void* arg) {
+    VM_reset(ctx->vm, ctx->vm->memory);
+}
+
+static void run_draw(Context* ctx, const void* arg, uint64_t units) {
+    VM* vm = ctx->vm;
+    Inst inst;
+    VM_decode(&inst, 0xD015);
+    for (uint64_t k = 0; k < units; k++) {
+        vm->v[0] = k * 7;
+        vm->v[1] = k * 3;
+        vm->i = (k & 15) * 5;
+        draw(&inst, vm);
+    }
+}
+
+static void run_math(Context* ctx, const void* arg, uint64_t units) {
+    static const uint16_t opcodes[8] = { 0x8014, 0x8015, 0x8016, 0x8017, 0x801E, 0x8011, 0x8012, 0x8013 };
+    VM* vm = ctx->vm;
+    Inst insts[8];
+    for (int op = 0; op < 8; op++)
+        VM_decode(&insts[op], opcodes[op]);
+    vm->v[1] = 0x5B;
+    for (uint64_t k = 0; k < units; k++)
+        math(&insts[k & 7], vm);
+}
+
+// The FXNN opcode is in arg
+static void run_f_family(Context* ctx, const void* arg, uint64_t units) {
+    VM* vm = ctx->vm;
+    Inst inst;
+    VM_decode(&inst, *(const uint16_t*)arg);
+    for (uint64_t k = 0; k < units; k++) {
+        vm->v[0] = k;
+        vm->i = 0x300;
+        f_family(&inst, vm);
+    }
+}
+
+static void run_clear_screen(Context* ctx, const void* arg, uint64_t units) {
+    VM* vm = ctx->vm;
+    Inst inst;
+    VM_decode(&inst, 0x00E0);
+    for (uint64_t k = 0; k < units; k++) {
+        vm->display.rows[k & (SCREEN_HEIGHT - 1)] = k;
+        clear_screen(&inst, vm);
+    }
+}
+
+// Display_render's conversion of a whole frame into ARGB pixels, without the SDL calls
+static void run_expand(Context* ctx, const void* arg, uint64_t units) {
+    Display* display = &ctx->vm->display;
+    for (uint64_t k = 0; k < units; k++) {
+        display->rows[k & (SCREEN_HEIGHT - 1)] = k * 0x9E3779B97F4A7C15ULL;
+        Display_expand(display, ctx->lut, ctx->pixels, SCREEN_WIDTH * sizeof(uint32_t), 0, SCREEN_HEIGHT - 1);
+    }
+}
+
+// What the audio callback does with the tone on, in buffers of AUDIO_BUFFER samples
+static void run_synth(Context* ctx, const void* arg, uint64_t units) {
+    Synth_set_tone(&ctx->synth, true);
+    for (uint64_t k = 0; k < units; k += AUDIO_BUFFER)
+        Synth_fill(&ctx->synth, ctx->samples, AUDIO_BUFFER);
+}
+
+static void setup_rom(Context* ctx, const void* arg) {
+    const Rom* rom = arg;
+    VM_free(ctx->vm);
+    ctx->vm = VM_init();
+    VM_load(ctx->vm, rom->code, rom->size);
+}
+
+static void run_rom(Context* ctx, const void* arg, uint64_t units) {
+    VM_exec(ctx->vm, units);
+}
+
+// One 60hz frame of the sprites ROM at the default speed, with the changed rows converted to pixels
+static void run_frame(Context* ctx, const void* arg, uint64_t units) {
+    VM* vm = ctx->vm;
+    for (uint64_t k = 0; k < units; k++) {
+        VM_exec(vm, VM_frame_instructions(vm, 500));
+        VM_tick_timers(vm);
+        uint32_t rows = vm->display.dirty;
+        if (rows) {
+            int top = __builtin_ctz(rows);
+            int bottom = 31 - __builtin_clz(rows);
+            Display_expand(&vm->display, ctx->lut, ctx->pixels, SCREEN_WIDTH * sizeof(uint32_t), top, bottom);
+            vm->display.dirty = 0;
+        }
+    }
+}
+
+static const uint16_t bcd_opcode = 0xF033;
+static const uint16_t load_opcode = 0xF565;
+static const uint16_t store_opcode = 0xF555;
+
+static const Benchmark benchmarks[] = {
+    { "draw", "call", 1000000, setup_handler, run_draw, NULL },
+    { "math", "call", 4000000, setup_handler, run_math, NULL },
+    { "f_family_bcd", "call", 2000000, setup_handler, run_f_family, &bcd_opcode },
+    { "f_family_load", "call", 2000000, setup_handler, run_f_family, &load_opcode },
+    { "f_family_store", "call", 2000000, setup_handler, run_f_family, &store_opcode },
+    { "clear_screen", "call", 2000000, setup_handler, run_clear_screen, NULL },
+    { "render_expand", "frame", 50000, NULL, run_expand, NULL },
+    { "audio_synth", "sample", 4000000, NULL, run_synth, NULL },
+    { "rom_alu", "inst", 20000000, setup_rom, run_rom, &roms[0] },
+    { "rom_sprites", "inst", 20000000, setup_rom, run_rom, &roms[1] },
+    { "rom_bcd", "inst", 20000000, setup_rom, run_rom, &roms[2] },
+    { "rom_calls", "inst", 20000000, setup_rom, run_rom, &roms[3] },
+    { "frame", "frame", 20000, setup_rom, run_frame, &roms[1] },
+};
+
+#define BENCHMARK_COUNT (int)(sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+typedef struct {
+    double median;
+    double min;
+    double stddev;
+} Stats;
+
+static int by_value(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Nanoseconds per unit over `reps` repetitions, after one untimed run
+static Stats measure(Context* ctx, const Benchmark* bench, int reps) {
+    double* times = calloc(reps, sizeof(double));
+    for (int rep = -1; rep < reps; rep++) {
+        if (bench->setup)
+            bench->setup(ctx, bench->arg);
+        uint64_t start = Clock_now_ns();
+        bench->run(ctx, bench->arg, bench->units);
+        uint64_t elapsed = Clock_now_ns() - start;
+        if (rep >= 0)
+            times[rep] = (double)elapsed / bench->units;
+    }
+
+    qsort(times, reps, sizeof(double), by_value);
+    Stats stats = { times[reps / 2], times[0], 0 };
+    if (reps % 2 == 0)
+        stats.median = (times[reps / 2 - 1] + times[reps / 2]) / 2;
+    double mean = 0;
+    for (int rep = 0; rep < reps; rep++)
+        mean += times[rep] / reps;
+    for (int rep = 0; rep < reps; rep++)
+        stats.stddev += (times[rep] - mean) * (times[rep] - mean) / reps;
+    stats.stddev = sqrt(stats.stddev);
+    free(times);
+    return stats;
+}
+
+static bool selected(const Benchmark* bench, char** names, int count) {
+    if (count == 0)
+        return true;
+    for (int n = 0; n < count; n++) {
+        if (strstr(bench->name, names[n]))
+            return true;
+    }
+    return false;
+}
+
+void usage() {
+    printf("Usage: chip8-bench [options] [name...]\n");
+    printf("  --reps <n>     timed repetitions of every benchmark (default %d)\n", DEFAULT_REPS);
+    printf("  --json         print the results as a JSON array\n");
+    printf("  --list         print the benchmark names\n");
+}
+
+int main(int argc, char** argv) {
+    int reps = DEFAULT_REPS;
+    bool json = false;
+    char** names = calloc(argc, sizeof(char*));
+    int name_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+            if (reps < 1)
+                reps = 1;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "--list") == 0) {
+            for (int b = 0; b < BENCHMARK_COUNT; b++)
+                printf("%s\n", benchmarks[b].name);
+            free(names);
+            return 0;
+        } else if (argv[i][0] != '-') {
+            names[name_count++] = argv[i];
+        } else {
+            usage();
+            free(names);
+            return 0;
+        }
+    }
+
+    Context* ctx = calloc(1, sizeof(Context));
+    ctx->vm = VM_init();
+    PixelLUT_init(ctx->lut, 0xFF306230, 0xFF8BAC0F);
+    Synth_init(&ctx->synth, SAMPLE_RATE, TONE_FREQUENCY, 2000);
+
+    if (json)
+        printf("[");
+    else
+        printf("%-16s %8s %12s %12s %10s %16s\n", "benchmark", "unit", "ns/unit", "min", "stddev", "units/sec");
+    int printed = 0;
+    for (int b = 0; b < BENCHMARK_COUNT; b++) {
+        const Benchmark* bench = &benchmarks[b];
+        if (!selected(bench, names, name_count))
+            continue;
+
+        Stats stats = measure(ctx, bench, reps);
+        double rate = stats.median > 0 ? 1e9 / stats.median : 0;
+        if (json) {
+            printf("%s\n  {\"name\": \"%s\", \"unit\": \"%s\", \"units\": %llu, \"reps\": %d, "
+                "\"ns_median\": %.4f, \"ns_min\": %.4f, \"ns_stddev\": %.4f, \"per_sec\": %.0f}",
+                printed ? "," : "", bench->name, bench->unit, (unsigned long long)bench->units, reps,
+                stats.median, stats.min, stats.stddev, rate);
+        } else {
+            printf("%-16s %8s %12.3f %12.3f %10.3f %16.0f\n", bench->name, bench->unit, stats.median,
+                stats.min, stats.stddev, rate);
+        }
+        printed++;
+        fflush(stdout);
+    }
+    if (json)
+        printf("%s]\n", printed ? "\n" : "");
+
+    VM_free(ctx->vm);
+    free(ctx);
+    free(names);
+    return 0;
+}
@@ -0,0 +1,100 @@
+#ifndef ROMS_H
+#define ROMS_H
+
+#include <stdint.h>
+
+typedef struct {
+    const char* name;
+    const uint8_t* code;
+    uint16_t size;
+} Rom;
+
+/*
+ * Workloads written for the benchmarks and the checks in check/check.c, each an endless loop:
+ * alu runs arithmetic and logic between registers, sprites draws the font digits across the
+ * screen and clears it every 16, bcd converts a counter and stores and loads registers, calls
+ * is mostly subroutine calls and returns. The rest are for the checks: selfmod rewrites an
+ * instruction it runs next, idle polls the delay timer, and mixed covers random numbers, timers,
+ * shifts, keys, FX0A and BNNN.
+ */
+static const uint8_t alu_code[] = {
+    0x60, 0x00, 0x61, 0x01, 0x62, 0x03,  // 200: V0 = 0, V1 = 1, V2 = 3
+    0x80, 0x14, 0x81, 0x25, 0x82, 0x06,  // 206: V0 += V1, V1 -= V2, V2 >>= 1
+    0x72, 0x03, 0x80, 0x13,              // 20C: V2 += 3, V0 ^= V1
+    0x30, 0x00, 0x12, 0x06,              // 210: skip if V0 == 0, else back to 206
+    0x12, 0x00                           // 214: start over
+};
+
+static const uint8_t sprites_code[] = {
+    0x00, 0xE0, 0x60, 0x00, 0x61, 0x00,  // 200: CLS, V0 = 0, V1 = 0
+    0x62, 0x00,                          // 206: V2 = 0
+    0xF2, 0x29, 0xD0, 0x15,              // 208: I = digit V2, draw it at V0, V1
+    0x70, 0x05, 0x71, 0x03, 0x72, 0x01,  // 20C: V0 += 5, V1 += 3, V2 += 1
+    0x42, 0x10, 0x12, 0x00,              // 212: start over after digit F
+    0x12, 0x08                           // 216: next digit
+};
+
+static const uint8_t bcd_code[] = {
+    0x63, 0x00,                          // 200: V3 = 0
+    0xA3, 0x00, 0xF3, 0x33, 0xF2, 0x65,  // 202: I = 300, BCD of V3, load V0-V2
+    0x80, 0x14, 0x80, 0x24,              // 208: V0 += V1, V0 += V2
+    0xA3, 0x10, 0xF5, 0x55,              // 20C: I = 310, store V0-V5
+    0x73, 0x01, 0x12, 0x02               // 210: V3 += 1, again
+};
+
+static const uint8_t calls_code[] = {
+    0x60, 0x00,                          // 200: V0 = 0
+    0x22, 0x10, 0x22, 0x14, 0x12, 0x02,  // 202: call 210, call 214, again
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x70, 0x01, 0x00, 0xEE,              // 210: V0 += 1, return
+    0x81, 0x04, 0x00, 0xEE               // 214: V1 += V0, return
+};
+
+static const uint8_t selfmod_code[] = {
+    0x60, 0x72, 0x61, 0x00,              // 200: V0 = 72, V1 = 0
+    0x71, 0x03, 0xA2, 0x0C, 0xF1, 0x55,  // 204: V1 += 3, I = 20C, store V0-V1 over 20C
+    0x12, 0x0C,                          // 20A: jump to the rewritten instruction
+    0x72, 0x00, 0x12, 0x04               // 20C: V2 += V1 as stored, again
+};
+
+static const uint8_t idle_code[] = {
+    0x60, 0x1E, 0xF0, 0x15,              // 200: delay = 30
+    0xF1, 0x07, 0x31, 0x00, 0x12, 0x04,  // 204: until the delay ran out
+    0x72, 0x01, 0x12, 0x00               // 20A: V2 += 1, again
+};
+
+static const uint8_t mixed_code[] = {
+    0xC0, 0xFF, 0xC1, 0x3F,              // 200: V0 = random, V1 = random & 3F
+    0xF0, 0x15, 0xF3, 0x07, 0xF1, 0x18,  // 204: delay = V0, V3 = delay, sound = V1
+    0x80, 0x16, 0x81, 0x0E,              // 20A: V0 >>= 1, V1 <<= 1
+    0x90, 0x10, 0x74, 0x01,              // 20E: unless V0 != V1, V4 += 1
+    0xF4, 0x29, 0xD0, 0x15,              // 212: I = digit V4, draw it at V0, V1
+    0xE5, 0x9E, 0x75, 0x01,              // 216: unless key V5 is held, V5 += 1
+    0x45, 0x10, 0x65, 0x00,              // 21A: wrap V5 at 16
+    0xE5, 0xA1, 0xF6, 0x0A,              // 21E: if key V5 is held, wait for a key into V6
+    0xF6, 0x1E, 0x60, 0x02, 0xB2, 0x28,  // 222: I += V6, V0 = 2, jump to 228 + V0
+    0x12, 0x00, 0x12, 0x00               // 228: start over
+};
+
+static const uint8_t wrap_code[] = {
+    0x60, 0x72, 0x61, 0x01,              // 200: V0 = 72, V1 = 01
+    0x62, 0x12, 0x63, 0x0C,              // 204: V2 = 12, V3 = 0C
+    0xA0, 0xF0, 0xF3, 0x55,              // 208: store 7201 120C (V2 += 1, jump to 20C) over 0F0
+    0x74, 0x01, 0x60, 0xF1,              // 20C: V4 += 1, V0 = F1
+    0xBF, 0xFF                           // 210: jump to FFF + V0, past the end of memory to 0F0
+};
+
+static const Rom roms[] = {
+    { "alu", alu_code, sizeof(alu_code) },
+    { "sprites", sprites_code, sizeof(sprites_code) },
+    { "bcd", bcd_code, sizeof(bcd_code) },
+    { "calls", calls_code, sizeof(calls_code) },
+    { "selfmod", selfmod_code, sizeof(selfmod_code) },
+    { "idle", idle_code, sizeof(idle_code) },
+    { "mixed", mixed_code, sizeof(mixed_code) },
+    { "wrap", wrap_code, sizeof(wrap_code) },
+};
+
+#define ROM_COUNT (int)(sizeof(roms) / sizeof(roms[0]))
+
+#endif
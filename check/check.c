@@ -0,0 +1,191 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm.h"
+#include "jit.h"
+#include "lockstep.h"
+#include "snapshot.h"
+#include "check.h"
+#include "roms.h"
+
+/*
+ * Differential checks: chip8-check [--frames <n>] [--write-roms <dir>]
+ *
+ * Runs the ROMs of bench/roms.h through every executor and compares the complete machine state
+ * (a snapshot) with a reference after every frame. Lockstep runs LOCKSTEP_LANES copies seeded
+ * differently, so ROMs using random numbers make lanes diverge and meet again. The reference runs one instruction at a time
+ * with VM_tick, so VM_exec's fast paths are checked as well. Frames run an uneven number of
+ * instructions and hold changing keys. Exits with 1 at the first difference.
+ *
+ * --write-roms writes the ROMs to <dir>/<name>.ch8 instead, for `make check` to translate with
+ * chip8-aot and run with --check, which runs the same frame loop from src/check.h.
+ */
+
+#define DEFAULT_FRAMES 600
+#define CHECK_IPS 7919  // also in the Makefile, prime so batches vary in size and end at every point of a loop
+
+typedef struct {
+    const char* name;
+    void* (*init)(VM* vm);  // NULL if the engine isn't available on this host
+    void (*exec)(void* data, VM* vm, uint32_t count);
+    void (*free)(void* data);
+} Engine;
+
+static void* interpreter_init(VM* vm) {
+    return vm;
+}
+
+static void interpreter_exec(void* data, VM* vm, uint32_t count) {
+    VM_exec(vm, count);
+}
+
+static void interpreter_free(void* data) {
+}
+
+static void* jit_init(VM* vm) {
+    return JIT_init(vm);
+}
+
+static void jit_exec(void* data, VM* vm, uint32_t count) {
+    JIT_exec(data, count);
+}
+
+static void jit_free(void* data) {
+    JIT_free(data);
+}
+
+static const Engine engines[] = {
+    { "interpreter", interpreter_init, interpreter_exec, interpreter_free },
+    { "jit", jit_init, jit_exec, jit_free },
+};
+
+#define ENGINE_COUNT (int)(sizeof(engines) / sizeof(engines[0]))
+
+static VM* load(const Rom* rom) {
+    VM* vm = VM_init();
+    VM_load(vm, rom->code, rom->size);
+    return vm;
+}
+
+// Offset of the first byte where the two VMs' snapshots differ, -1 if they're the same
+static long compare(const VM* a, const VM* b) {
+    static uint8_t left[SNAPSHOT_SIZE];
+    static uint8_t right[SNAPSHOT_SIZE];
+    VM_snapshot(a, left);
+    VM_snapshot(b, right);
+    for (long k = 0; k < SNAPSHOT_SIZE; k++) {
+        if (left[k] != right[k])
+            return k;
+    }
+    return -1;
+}
+
+// Returns false after printing where `engine` first diverged from the reference on `rom`
+static bool check(const Rom* rom, const Engine* engine, uint64_t frames) {
+    VM* reference = load(rom);
+    VM* vm = load(rom);
+    void* data = engine->init(vm);
+    if (data == NULL) {
+        printf("%-10s %-12s not available on this host\n", rom->name, engine->name);
+        VM_free(reference);
+        VM_free(vm);
+        return true;
+    }
+
+    uint64_t frame;
+    long diff = Check_frames(reference, vm, engine->exec, data, CHECK_IPS, frames, &frame);
+
+    if (diff < 0)
+        printf("%-10s %-12s ok, %llu instructions\n", rom->name, engine->name,
+            (unsigned long long)vm->instructions);
+    else
+        printf("%-10s %-12s differs at frame %llu, snapshot byte %ld\n", rom->name, engine->name,
+            (unsigned long long)frame, diff);
+    engine->free(data);
+    VM_free(reference);
+    VM_free(vm);
+    return diff < 0;
+}
+
+static bool check_lockstep(const Rom* rom, uint64_t frames) {
+    VM* references[LOCKSTEP_LANES];
+    VM* vms[LOCKSTEP_LANES];
+    for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+        references[lane] = load(rom);
+        vms[lane] = load(rom);
+        VM_seed(references[lane], lane + 1);
+        VM_seed(vms[lane], lane + 1);
+    }
+    Lockstep* lockstep = Lockstep_init(vms, LOCKSTEP_LANES);
+
+    long diff = -1;
+    int lane = 0;
+    uint64_t frame = 0;
+    for (; frame < frames && diff < 0; frame++) {
+        uint32_t batch = VM_frame_instructions(references[0], CHECK_IPS);
+        for (lane = 0; lane < LOCKSTEP_LANES; lane++) {
+            references[lane]->keyboard.keys = vms[lane]->keyboard.keys = Check_frame_keys(frame);
+            for (uint32_t n = 0; n < batch; n++)
+                VM_tick(references[lane]);
+            VM_tick_timers(references[lane]);
+        }
+        Lockstep_exec(lockstep, batch);
+        for (lane = 0; lane < LOCKSTEP_LANES && diff < 0; lane++) {
+            VM_tick_timers(vms[lane]);
+            diff = compare(references[lane], vms[lane]);
+        }
+    }
+
+    LockstepStats stats = Lockstep_stats(lockstep);
+    if (diff < 0)
+        printf("%-10s %-12s ok, %.1f%% vectorized\n", rom->name, "lockstep",
+            100.0 * stats.vector / (stats.vector + stats.scalar));
+    else
+        printf("%-10s %-12s lane %d differs at frame %llu, snapshot byte %ld\n", rom->name, "lockstep",
+            lane - 1, (unsigned long long)frame - 1, diff);
+    Lockstep_free(lockstep);
+    for (lane = 0; lane < LOCKSTEP_LANES; lane++) {
+        VM_free(references[lane]);
+        VM_free(vms[lane]);
+    }
+    return diff < 0;
+}
+
+static bool write_roms(const char* dir) {
+    char fpath[4096];
+    for (int r = 0; r < ROM_COUNT; r++) {
+        snprintf(fpath, sizeof(fpath), "%s/%s.ch8", dir, roms[r].name);
+        FILE* fd = fopen(fpath, "wb");
+        if (fd == NULL || fwrite(roms[r].code, 1, roms[r].size, fd) != roms[r].size) {
+            printf("Couldn't write %s\n", fpath);
+            if (fd)
+                fclose(fd);
+            return false;
+        }
+        fclose(fd);
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    uint64_t frames = DEFAULT_FRAMES;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--write-roms") == 0 && i + 1 < argc) {
+            return write_roms(argv[++i]) ? 0 : 1;
+        } else {
+            printf("Usage: chip8-check [--frames <n>] [--write-roms <dir>]\n");
+            return 0;
+        }
+    }
+
+    bool ok = true;
+    for (int r = 0; r < ROM_COUNT; r++) {
+        for (int e = 0; e < ENGINE_COUNT; e++)
+            ok &= check(&roms[r], &engines[e], frames);
+        ok &= check_lockstep(&roms[r], frames);
+    }
+    return ok ? 0 : 1;
+}
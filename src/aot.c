@@ -0,0 +1,238 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm.h"
+#include "aot.h"
+
+/*
+ * Ahead-of-time translator: chip8-aot <rom> <out.c>
+ *
+ * Walks the control flow of a ROM from PROGRAM_START_ADDR and writes a C file where every
+ * reachable instruction is a label that calls its handler and jumps straight to its successors.
+ * Link the output with the headless core and aot_runtime.c (see `make native`).
+ */
+
+// Handler called for each Op, the same ones the interpreter uses
+static const char* handler_names[OP_COUNT] = {
+    [OP_CLS] = "clear_screen", [OP_RET] = "subroutine_return", [OP_JP] = "jump",
+    [OP_CALL] = "subroutine_call", [OP_SE] = "skip_equal", [OP_SNE] = "skip_not_equal",
+    [OP_SVE] = "skip_registers_equal", [OP_LD_V] = "load_v", [OP_ADD] = "add", [OP_MOV] = "math_load",
+    [OP_OR] = "math_or", [OP_AND] = "math_and", [OP_XOR] = "math_xor", [OP_ADD_V] = "math_add",
+    [OP_SUB] = "math_sub", [OP_SHR] = "math_shr", [OP_SUBN] = "math_subn", [OP_SHL] = "math_shl",
+    [OP_SVNE] = "skip_registers_not_equal", [OP_LD_I] = "load_i", [OP_JP_V0] = "jump_offset",
+    [OP_RND] = "rnd", [OP_DRW] = "draw", [OP_SKP] = "skip_key_pressed",
+    [OP_SKNP] = "skip_key_not_pressed", [OP_LD_VDT] = "load_delay", [OP_LD_K] = "wait_key",
+    [OP_LD_DT] = "set_delay", [OP_LD_ST] = "set_sound", [OP_ADD_I] = "add_i", [OP_LD_F] = "load_font",
+    [OP_BCD] = "store_bcd", [OP_STORE] = "store_registers", [OP_LOAD] = "load_registers",
+    [OP_ILLEGAL] = "illegal"
+};
+
+typedef struct {
+    VM* vm;
+    uint16_t end;                   // first address past the ROM
+    uint8_t translated[MEMORY_SIZE];
+    uint8_t targeted[MEMORY_SIZE];  // jumped to by translated code, needs an L_ label
+    Inst insts[MEMORY_SIZE];
+} Translator;
+
+static bool in_rom(Translator* t, uint16_t addr) {
+    return addr >= PROGRAM_START_ADDR && addr + 1 < t->end;
+}
+
+static bool is_start(Translator* t, uint16_t addr) {
+    return addr < MEMORY_SIZE && t->translated[addr] == AOT_START;
+}
+
+// Successors known at translation time, returns how many were written to next
+static int successors(Inst* inst, uint16_t addr, uint16_t next[2]) {
+    switch (inst->op) {
+        case OP_JP:
+            next[0] = inst->nnn;
+            return 1;
+        case OP_CALL:
+            next[0] = inst->nnn;
+            next[1] = addr + 2;
+            return 2;
+        case OP_SE: case OP_SNE: case OP_SVE: case OP_SVNE: case OP_SKP: case OP_SKNP:
+            next[0] = addr + 2;
+            next[1] = addr + 4;
+            return 2;
+        case OP_RET: case OP_JP_V0: case OP_ILLEGAL:
+            return 0;
+        default:
+            next[0] = addr + 2;
+            return 1;
+    }
+}
+
+static void walk(Translator* t) {
+    uint16_t worklist[2 * MEMORY_SIZE + 1];  // every instruction pushes at most two successors
+    int pending = 0;
+    worklist[pending++] = PROGRAM_START_ADDR;
+
+    while (pending > 0) {
+        uint16_t addr = worklist[--pending];
+        if (!in_rom(t, addr) || t->translated[addr] == AOT_START)
+            continue;
+
+        Inst* inst = &t->insts[addr];
+        VM_decode(inst, t->vm->memory[addr] << 8 | t->vm->memory[addr + 1]);
+        t->translated[addr] = AOT_START;
+        // Overlapping instructions keep their start marker
+        if (!t->translated[addr + 1])
+            t->translated[addr + 1] = AOT_TAIL;
+
+        uint16_t next[2];
+        int count = successors(inst, addr, next);
+        for (int i = 0; i < count; i++) {
+            worklist[pending++] = next[i];
+            // Wait key and call returns come back through the dispatcher
+            bool returns = inst->op == OP_CALL && i == 1;
+            if (inst->op != OP_LD_K && !returns && next[i] < MEMORY_SIZE)
+                t->targeted[next[i]] = 1;
+        }
+    }
+}
+
+// Jumps to a successor label, or back to the dispatcher if it wasn't translated
+static void emit_goto(Translator* t, FILE* out, uint16_t target) {
+    if (is_start(t, target))
+        fprintf(out, "goto L_%03X;", target);
+    else
+        fprintf(out, "goto dispatch;");
+}
+
+static void emit_inst(Translator* t, FILE* out, uint16_t addr) {
+    Inst* inst = &t->insts[addr];
+
+    if (t->targeted[addr]) {
+        fprintf(out, "L_%03X:\n", addr);
+        fprintf(out, "    if (!budget || dirty) goto dispatch;\n");
+    }
+    fprintf(out, "E_%03X:\n", addr);
+    fprintf(out, "    budget--;\n");
+    fprintf(out, "    vm->pc = 0x%03X;\n", addr + 2);  // unmasked, like the interpreter
+    fprintf(out, "    %s(&i_%03X, vm);  // %04X %s\n", handler_names[inst->op], addr,
+        inst->opcode, op_names[inst->op]);
+
+    switch (inst->op) {
+        case OP_BCD: case OP_STORE:
+            fprintf(out, "    if (AOT_check_stores(state, vm)) { dirty = true; goto dispatch; }\n");
+            break;
+        case OP_SE: case OP_SNE: case OP_SVE: case OP_SVNE: case OP_SKP: case OP_SKNP:
+            fprintf(out, "    if (vm->pc == 0x%03X) ", addr + 4);
+            emit_goto(t, out, addr + 4);
+            fprintf(out, "\n");
+            break;
+        default:
+            break;
+    }
+
+    uint16_t next[2];
+    int count = successors(inst, addr, next);
+    fprintf(out, "    ");
+    // Wait key rewinds pc, return and BNNN are only known at runtime
+    if (count == 0 || inst->op == OP_LD_K)
+        fprintf(out, "goto dispatch;");
+    else
+        emit_goto(t, out, next[0]);
+    fprintf(out, "\n\n");
+}
+
+static void emit(Translator* t, FILE* out, const char* rom_path) {
+    fprintf(out, "// Generated by chip8-aot from %s, do not edit.\n", rom_path);
+    fprintf(out, "#include \"aot.h\"\n\n");
+
+    uint16_t size = t->end - PROGRAM_START_ADDR;
+    fprintf(out, "static const uint8_t rom[%u] = {", size);
+    for (int i = 0; i < size; i++)
+        fprintf(out, "%s0x%02X,", i % 16 ? " " : "\n    ", t->vm->memory[PROGRAM_START_ADDR + i]);
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "static const uint8_t translated[MEMORY_SIZE] = {\n");
+    for (int addr = 0; addr < MEMORY_SIZE; addr++) {
+        if (t->translated[addr])
+            fprintf(out, "    [0x%03X] = %s,\n", addr, t->translated[addr] == AOT_START ? "AOT_START" : "AOT_TAIL");
+    }
+    fprintf(out, "};\n\n");
+
+    for (int addr = 0; addr < MEMORY_SIZE; addr++) {
+        if (!is_start(t, addr))
+            continue;
+        Inst* inst = &t->insts[addr];
+        fprintf(out, "static Inst i_%03X = { 0x%04X, 0x%X, %u, 0x%X, 0x%X, 0x%X, 0x%02X, 0x%03X };\n",
+            addr, inst->opcode, inst->family, inst->op, inst->x, inst->y, inst->n, inst->nn, inst->nnn);
+    }
+
+    fprintf(out, "\nstatic void exec(void* data, VM* vm, uint32_t count) {\n");
+    fprintf(out, "    AOTState* state = data;\n");
+    fprintf(out, "    uint32_t budget = count;\n");
+    fprintf(out, "    uint32_t interpreted = 0;\n");
+    fprintf(out, "    bool dirty = state->dirty;\n\n");
+    fprintf(out, "dispatch:\n");
+    fprintf(out, "    while (budget) {\n");
+    fprintf(out, "        if (AOT_is_native(state, vm->pc)) {\n");
+    fprintf(out, "            switch (vm->pc) {\n");
+    for (int addr = 0; addr < MEMORY_SIZE; addr++) {
+        if (is_start(t, addr))
+            fprintf(out, "                case 0x%03X: goto E_%03X;\n", addr, addr);
+    }
+    fprintf(out, "            }\n");
+    fprintf(out, "        }\n");
+    fprintf(out, "        VM_exec(vm, 1);\n");
+    fprintf(out, "        budget--;\n");
+    fprintf(out, "        interpreted++;\n");
+    fprintf(out, "        if (AOT_check_stores(state, vm))\n");
+    fprintf(out, "            dirty = true;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    goto done;\n\n");
+
+    for (int addr = 0; addr < MEMORY_SIZE; addr++) {
+        if (is_start(t, addr))
+            emit_inst(t, out, addr);
+    }
+
+    fprintf(out, "done:\n");
+    fprintf(out, "    // VM_exec already counted the interpreted instructions\n");
+    fprintf(out, "    vm->instructions += count - budget - interpreted;\n");
+    fprintf(out, "}\n\n");
+
+    fprintf(out, "int main(int argc, char** argv) {\n");
+    fprintf(out, "    return AOT_main(argc, argv, rom, sizeof(rom), translated, exec);\n");
+    fprintf(out, "}\n");
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        printf("Usage: chip8-aot <rom> <out.c>\n");
+        return 1;
+    }
+
+    Translator* t = calloc(1, sizeof(Translator));
+    t->vm = VM_init();
+    int16_t size = VM_load_rom(t->vm, argv[1]);
+    if (size < 0) {
+        printf("Failed to open ROM file %s\n", argv[1]);
+        return 1;
+    }
+    t->end = PROGRAM_START_ADDR + size;
+    walk(t);
+
+    FILE* out = fopen(argv[2], "w");
+    if (out == NULL) {
+        printf("Failed to open %s for writing\n", argv[2]);
+        return 1;
+    }
+    emit(t, out, argv[1]);
+    fclose(out);
+
+    int count = 0;
+    for (int addr = 0; addr < MEMORY_SIZE; addr++)
+        count += is_start(t, addr);
+    printf("Translated %d instructions\n", count);
+
+    VM_free(t->vm);
+    free(t);
+    return 0;
+}
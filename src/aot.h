@@ -0,0 +1,34 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vm.h"
+#include "handlers.h"
+#include "run.h"
+
+/*
+ * Runtime support for C files generated by chip8-aot. Translated code runs straight-line;
+ * anything it can't reach statically, or that the ROM overwrote, goes through the interpreter.
+ */
+#define AOT_START 1  // first byte of a translated instruction
+#define AOT_TAIL 2   // second byte
+
+typedef struct {
+    const uint8_t* translated;      // AOT_START or AOT_TAIL for every byte of a translated instruction
+    uint8_t modified[MEMORY_SIZE];  // translated bytes the ROM has stored to since
+    uint64_t epoch;                 // vm->cache.invalidations when stores were last checked
+    bool dirty;                     // any translated byte modified, translated code checks each label
+} AOTState;
+
+// True if translated code at addr can still be used, addr is a raw pc and may be past 0xFFF
+static inline bool AOT_is_native(AOTState* state, uint16_t addr) {
+    addr &= ADDR_MASK;
+    return state->translated[addr] == AOT_START && !state->modified[addr] && !state->modified[(addr + 1) & ADDR_MASK];
+}
+
+bool AOT_check_stores(AOTState* state, VM* vm);
+int AOT_main(int argc, char** argv, const uint8_t* rom, uint16_t size, const uint8_t* translated,
+    Executor exec);
+
+#endif
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aot.h"
+#include "io.h"
+#include "clock.h"
+#include "check.h"
+
+/*
+ * Called after stores. Stores only invalidate decode cache entries that are valid, which is
+ * why AOT_main decodes every translated instruction up front.
+ */
+bool AOT_check_stores(AOTState* state, VM* vm) {
+    DecodeCache* cache = &vm->cache;
+    if (cache->invalidations == state->epoch)
+        return false;
+
+    bool hit = false;
+    for (int addr = cache->dirty_lo; addr <= cache->dirty_hi && addr < MEMORY_SIZE; addr++) {
+        if (state->translated[addr]) {
+            state->modified[addr] = 1;
+            hit = true;
+        }
+    }
+
+    state->dirty |= hit;
+    state->epoch = cache->invalidations;
+    cache->dirty_lo = MEMORY_SIZE;
+    cache->dirty_hi = 0;
+    return hit;
+}
+
+static void usage(char* name) {
+    printf("Usage: %s [options]\n", name);
+    printf("  --dump <file>  write the last frame to <file> as a PBM image\n");
+    printf("  --frames <n>   stop after n 60hz frames\n");
+    printf("  --ips <n>      instructions per second (default %d)\n", DEFAULT_IPS);
+    printf("  --turbo        run as fast as the host allows\n");
+    printf("  --check        compare every frame with the interpreter instead, see `make check`\n");
+}
+
+/*
+ * Runs the translated code and the interpreter side by side for `frames` frames and compares
+ * their snapshots after every one, see check.h. Prints the first frame they differ at, if any.
+ */
+static bool check(VM* vm, Executor exec, void* data, const uint8_t* rom, uint16_t size, uint32_t ips,
+    uint64_t frames) {
+    VM* reference = VM_init();
+    VM_load(reference, rom, size);
+
+    uint64_t frame;
+    bool same = Check_frames(reference, vm, exec, data, ips, frames, &frame) < 0;
+    if (same)
+        printf("Matched the interpreter for %llu frames\n", (unsigned long long)frames);
+    else
+        printf("Differs from the interpreter at frame %llu\n", (unsigned long long)frame);
+    VM_free(reference);
+    return same;
+}
+
+/*
+ * main() of a translated ROM. Always headless, otherwise takes the same options as chip8.
+ */
+int AOT_main(int argc, char** argv, const uint8_t* rom, uint16_t size, const uint8_t* translated,
+    Executor exec) {
+    char* dump_path = NULL;
+    bool checking = false;
+    RunConfig config;
+    RunConfig_init(&config);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            dump_path = argv[++i];
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            config.frames = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--ips") == 0 && i + 1 < argc) {
+            config.ips = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--turbo") == 0) {
+            config.turbo = true;
+        } else if (strcmp(argv[i], "--check") == 0) {
+            checking = true;
+        } else {
+            usage(argv[0]);
+            return 0;
+        }
+    }
+
+    VM* vm = VM_init();
+    VM_load(vm, rom, size);
+
+    AOTState* state = calloc(1, sizeof(AOTState));
+    state->translated = translated;
+    for (int addr = 0; addr < MEMORY_SIZE; addr++) {
+        if (translated[addr] == AOT_START)
+            VM_decode_at(vm, addr);
+    }
+    state->epoch = vm->cache.invalidations;
+    vm->cache.dirty_lo = MEMORY_SIZE;
+    vm->cache.dirty_hi = 0;
+
+    if (checking) {
+        uint64_t frames = config.frames ? config.frames : FRAME_RATE * 10;
+        bool same = check(vm, exec, state, rom, size, config.ips, frames);
+        VM_free(vm);
+        free(state);
+        return same ? 0 : 1;
+    }
+
+    IO* io = dump_path ? IO_init_dump(dump_path) : IO_init_null();
+    if (io == NULL) {
+        VM_free(vm);
+        free(state);
+        return 1;
+    }
+
+    config.exec = exec;
+    config.exec_data = state;
+
+    uint64_t start = Clock_now_ns();
+    VM_run(vm, io, &config);
+    double elapsed = (double)(Clock_now_ns() - start) / NS_PER_SEC;
+    printf("Executed %llu instructions in %.3fs (%.0f instructions/sec)\n",
+        (unsigned long long)vm->instructions, elapsed, elapsed > 0 ? vm->instructions / elapsed : 0);
+    int status = 0;
+    if (vm->halted) {
+        printf("Illegal instruction %02X%02X at 0x%03X\n", vm->memory[vm->pc & ADDR_MASK],
+            vm->memory[(vm->pc + 1) & ADDR_MASK], vm->pc & ADDR_MASK);
+        status = 1;
+    }
+
+    IO_free(io);
+    VM_free(vm);
+    free(state);
+    return status;
+}
@@ -0,0 +1,346 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dirent.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "vm.h"
+#include "io.h"
+#include "run.h"
+#include "clock.h"
+
+/*
+ * Regression runner: chip8-batch [options] <rom or directory>...
+ *
+ * Runs every ROM headless for a number of frames on a pool of threads and prints a hash of the
+ * final framebuffer, the instruction count and the wall time of each one.
+ */
+
+#define DEFAULT_FRAMES 600
+
+// Holds `key` from `frame` on, a key of -1 releases it
+typedef struct {
+    uint64_t frame;
+    int key;
+} ScriptEvent;
+
+typedef struct {
+    ScriptEvent* events;
+    size_t count;
+} Script;
+
+typedef struct {
+    const Script* script;
+    size_t next;
+    uint64_t frame;  // the frame whose input is read next, keys land before its batch runs
+} ScriptIO;
+
+typedef enum { STATUS_OK, STATUS_HALTED, STATUS_LOAD_ERROR } Status;
+
+static const char* status_names[] = { "ok", "halted", "load_error" };
+
+typedef struct {
+    char* path;
+    Status status;
+    uint64_t hash;
+    uint64_t instructions;
+    double seconds;
+} Result;
+
+/*
+ * Per thread queue of result indices. The owner takes jobs from the tail, idle threads steal
+ * from the head so they get the jobs the owner would run last.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    int* jobs;
+    int head;
+    int tail;
+} Deque;
+
+typedef struct {
+    Result* results;
+    Deque* deques;
+    int threads;
+    RunConfig config;
+    const Script* script;
+} Pool;
+
+typedef struct {
+    Pool* pool;
+    int id;
+} Worker;
+
+static bool script_process_input(IO* io, Keyboard* keyboard) {
+    ScriptIO* state = io->data;
+    while (state->next < state->script->count && state->script->events[state->next].frame <= state->frame) {
+        int key = state->script->events[state->next++].key;
+        keyboard->keys = key >= 0 ? 1 << key : 0;
+    }
+    state->frame++;
+    return true;
+}
+
+/*
+ * Reads an input script, one "<frame> <key>" line per event where key is a hex digit or "up"
+ * to release it. Events have to be in frame order, lines starting with # are skipped.
+ */
+static bool Script_load(Script* script, const char* fpath) {
+    FILE* fd = fopen(fpath, "r");
+    if (fd == NULL)
+        return false;
+
+    char line[128];
+    size_t capacity = 0;
+    while (fgets(line, sizeof(line), fd)) {
+        unsigned long long frame;
+        char key[16];
+        if (line[0] == '#' || sscanf(line, "%llu %15s", &frame, key) != 2)
+            continue;
+
+        if (script->count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            script->events = realloc(script->events, capacity * sizeof(ScriptEvent));
+        }
+        ScriptEvent* event = &script->events[script->count++];
+        event->frame = frame;
+        event->key = strcmp(key, "up") == 0 ? -1 : (int)(strtol(key, NULL, 16) & 0x0F);
+    }
+    fclose(fd);
+    return true;
+}
+
+static void run_rom(Pool* pool, Result* result) {
+    uint64_t start = Clock_now_ns();
+    VM* vm = VM_init();
+    if (VM_load_rom(vm, result->path) < 0) {
+        result->status = STATUS_LOAD_ERROR;
+        VM_free(vm);
+        return;
+    }
+
+    IO* io = IO_init_null();
+    ScriptIO state = { pool->script, 0, 0 };
+    if (pool->script) {
+        io->data = &state;
+        io->process_input = script_process_input;
+    }
+
+    VM_run(vm, io, &pool->config);
+
+    result->status = vm->halted ? STATUS_HALTED : STATUS_OK;
+    result->hash = Display_hash(&vm->display);
+    result->instructions = vm->instructions;
+    result->seconds = (double)(Clock_now_ns() - start) / NS_PER_SEC;
+    IO_free(io);
+    VM_free(vm);
+}
+
+// Next job for a worker, its own first and then stolen from the others. -1 once all are taken.
+static int next_job(Pool* pool, int id) {
+    Deque* own = &pool->deques[id];
+    int job = -1;
+    pthread_mutex_lock(&own->lock);
+    if (own->tail > own->head)
+        job = own->jobs[--own->tail];
+    pthread_mutex_unlock(&own->lock);
+
+    for (int i = 1; job < 0 && i < pool->threads; i++) {
+        Deque* victim = &pool->deques[(id + i) % pool->threads];
+        pthread_mutex_lock(&victim->lock);
+        if (victim->tail > victim->head)
+            job = victim->jobs[victim->head++];
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return job;
+}
+
+static void* worker_main(void* data) {
+    Worker* worker = data;
+    int job;
+    while ((job = next_job(worker->pool, worker->id)) >= 0)
+        run_rom(worker->pool, &worker->pool->results[job]);
+    return NULL;
+}
+
+static void add_rom(Result** results, int* count, int* capacity, const char* path) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        *results = realloc(*results, *capacity * sizeof(Result));
+    }
+    memset(&(*results)[*count], 0, sizeof(Result));
+    (*results)[(*count)++].path = strdup(path);
+}
+
+static int skip_hidden(const struct dirent* entry) {
+    return entry->d_name[0] != '.';
+}
+
+// Adds a ROM, or every file of a directory in name order
+static void add_path(Result** results, int* count, int* capacity, const char* path) {
+    struct stat info;
+    if (stat(path, &info) != 0 || !S_ISDIR(info.st_mode)) {
+        add_rom(results, count, capacity, path);
+        return;
+    }
+
+    struct dirent** entries;
+    int n = scandir(path, &entries, skip_hidden, alphasort);
+    for (int i = 0; i < n; i++) {
+        char file[4096];
+        snprintf(file, sizeof(file), "%s/%s", path, entries[i]->d_name);
+        if (stat(file, &info) == 0 && S_ISREG(info.st_mode))
+            add_rom(results, count, capacity, file);
+        free(entries[i]);
+    }
+    if (n >= 0)
+        free(entries);
+}
+
+static void write_json_string(FILE* out, const char* s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', out);
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static void write_results(FILE* out, Result* results, int count, uint64_t frames, bool json) {
+    if (json)
+        fprintf(out, "[\n");
+    else
+        fprintf(out, "rom,status,frames,instructions,hash,seconds\n");
+
+    for (int i = 0; i < count; i++) {
+        Result* r = &results[i];
+        if (json) {
+            fprintf(out, "  {\"rom\": ");
+            write_json_string(out, r->path);
+            fprintf(out, ", \"status\": \"%s\", \"frames\": %llu, \"instructions\": %llu, "
+                "\"hash\": \"%016llx\", \"seconds\": %.6f}%s\n", status_names[r->status],
+                (unsigned long long)frames, (unsigned long long)r->instructions,
+                (unsigned long long)r->hash, r->seconds, i + 1 < count ? "," : "");
+        } else {
+            fprintf(out, "%s,%s,%llu,%llu,%016llx,%.6f\n", r->path, status_names[r->status],
+                (unsigned long long)frames, (unsigned long long)r->instructions,
+                (unsigned long long)r->hash, r->seconds);
+        }
+    }
+
+    if (json)
+        fprintf(out, "]\n");
+}
+
+static void usage() {
+    printf("Usage: chip8-batch [options] <rom or directory>...\n");
+    printf("  --frames <n>   frames to run each ROM for (default %d)\n", DEFAULT_FRAMES);
+    printf("  --ips <n>      instructions per second (default %d)\n", DEFAULT_IPS);
+    printf("  --input <file> input script, \"<frame> <key>\" lines where key is 0-F or up\n");
+    printf("  --threads <n>  worker threads (default: one per core)\n");
+    printf("  --json         write JSON instead of CSV\n");
+    printf("  --out <file>   write results to <file> instead of stdout\n");
+}
+
+int main(int argc, char** argv) {
+    Pool pool = { 0 };
+    Script script = { 0 };
+    Result* results = NULL;
+    int count = 0;
+    int capacity = 0;
+    char* out_path = NULL;
+    bool json = false;
+
+    RunConfig_init(&pool.config);
+    pool.config.frames = DEFAULT_FRAMES;
+    pool.config.turbo = true;
+    pool.threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            pool.config.frames = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--ips") == 0 && i + 1 < argc) {
+            pool.config.ips = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            if (!Script_load(&script, argv[++i])) {
+                printf("Couldn't open input script \"%s\"\n", argv[i]);
+                return 1;
+            }
+            pool.script = &script;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            pool.threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (argv[i][0] == '-') {
+            usage();
+            return 0;
+        } else {
+            add_path(&results, &count, &capacity, argv[i]);
+        }
+    }
+
+    if (count == 0 || pool.config.frames == 0) {
+        usage();
+        return 0;
+    }
+    if (pool.threads < 1)
+        pool.threads = 1;
+    if (pool.threads > count)
+        pool.threads = count;
+
+    // Deal the ROMs out round robin, stealing evens out ROMs that run slower than others
+    pool.results = results;
+    pool.deques = calloc(pool.threads, sizeof(Deque));
+    for (int t = 0; t < pool.threads; t++) {
+        pthread_mutex_init(&pool.deques[t].lock, NULL);
+        pool.deques[t].jobs = calloc(count / pool.threads + 1, sizeof(int));
+    }
+    for (int i = 0; i < count; i++) {
+        Deque* deque = &pool.deques[i % pool.threads];
+        deque->jobs[deque->tail++] = i;
+    }
+
+    uint64_t start = Clock_now_ns();
+    pthread_t* threads = calloc(pool.threads, sizeof(pthread_t));
+    Worker* workers = calloc(pool.threads, sizeof(Worker));
+    for (int t = 0; t < pool.threads; t++) {
+        workers[t].pool = &pool;
+        workers[t].id = t;
+        pthread_create(&threads[t], NULL, worker_main, &workers[t]);
+    }
+    for (int t = 0; t < pool.threads; t++)
+        pthread_join(threads[t], NULL);
+    double elapsed = (double)(Clock_now_ns() - start) / NS_PER_SEC;
+
+    FILE* out = out_path ? fopen(out_path, "w") : stdout;
+    if (out == NULL) {
+        printf("Couldn't open \"%s\" for writing\n", out_path);
+        return 1;
+    }
+    write_results(out, results, count, pool.config.frames, json);
+    if (out != stdout)
+        fclose(out);
+    fprintf(stderr, "Ran %d ROMs on %d threads in %.3fs\n", count, pool.threads, elapsed);
+
+    int failures = 0;
+    for (int i = 0; i < count; i++) {
+        failures += results[i].status != STATUS_OK;
+        free(results[i].path);
+    }
+    for (int t = 0; t < pool.threads; t++) {
+        pthread_mutex_destroy(&pool.deques[t].lock);
+        free(pool.deques[t].jobs);
+    }
+    free(pool.deques);
+    free(threads);
+    free(workers);
+    free(results);
+    free(script.events);
+    return failures != 0;
+}
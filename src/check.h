@@ -0,0 +1,46 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdint.h>
+#include "vm.h"
+#include "run.h"
+#include "snapshot.h"
+
+/*
+ * Frame loop of the differential checks, shared by check/check.c and the --check option of
+ * ROMs translated by chip8-aot so both hold the same keys and compare the same way.
+ */
+
+// Keys held during a frame: a different key every 5 frames, held for 2 of them
+static inline uint16_t Check_frame_keys(uint64_t frame) {
+    return frame % 5 < 2 ? 1 << (frame / 5 % 16) : 0;
+}
+
+/*
+ * Runs up to `frames` frames of `ips` on `vm` through exec and on `reference` one VM_tick at a
+ * time, comparing their snapshots after every frame. Returns the offset of the first snapshot
+ * byte that differs, -1 if none did, and sets *frame to the frame it differed at.
+ */
+static inline long Check_frames(VM* reference, VM* vm, Executor exec, void* data, uint32_t ips,
+    uint64_t frames, uint64_t* frame) {
+    static uint8_t expected[SNAPSHOT_SIZE];
+    static uint8_t actual[SNAPSHOT_SIZE];
+    for (*frame = 0; *frame < frames; (*frame)++) {
+        uint32_t batch = VM_frame_instructions(reference, ips);
+        reference->keyboard.keys = vm->keyboard.keys = Check_frame_keys(*frame);
+        for (uint32_t n = 0; n < batch; n++)
+            VM_tick(reference);
+        exec(data, vm, batch);
+        VM_tick_timers(reference);
+        VM_tick_timers(vm);
+        VM_snapshot(reference, expected);
+        VM_snapshot(vm, actual);
+        for (long k = 0; k < SNAPSHOT_SIZE; k++) {
+            if (expected[k] != actual[k])
+                return k;
+        }
+    }
+    return -1;
+}
+
+#endif
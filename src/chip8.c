@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+
+struct Chip8Envs {
+    uint8_t image[MEMORY_SIZE];  // memory right after loading the ROM, what resets go back to
+    uint32_t ips;
+    int count;
+    VM** vms;
+};
+
+Chip8Envs* Chip8Envs_init(const uint8_t* rom, uint16_t size, int count, uint32_t ips) {
+    if (count < 1)
+        return NULL;
+
+    Chip8Envs* envs = calloc(1, sizeof(Chip8Envs));
+    envs->ips = ips;
+    envs->count = count;
+    envs->vms = calloc(count, sizeof(VM*));
+    for (int env = 0; env < count; env++) {
+        envs->vms[env] = VM_init();
+        VM_load(envs->vms[env], rom, size);
+    }
+    memcpy(envs->image, envs->vms[0]->memory, MEMORY_SIZE);
+    return envs;
+}
+
+void Chip8Envs_free(Chip8Envs* envs) {
+    for (int env = 0; env < envs->count; env++)
+        VM_free(envs->vms[env]);
+    free(envs->vms);
+    free(envs);
+}
+
+int Chip8Envs_count(Chip8Envs* envs) {
+    return envs->count;
+}
+
+void Chip8Envs_reset(Chip8Envs* envs, int env, uint32_t seed) {
+    VM_reset(envs->vms[env], envs->image);
+    VM_seed(envs->vms[env], seed);
+}
+
+void Chip8Envs_clone(Chip8Envs* envs, int to, int from) {
+    if (to != from)
+        VM_clone(envs->vms[to], envs->vms[from]);
+}
+
+static void observe(const Display* display, uint8_t* observation) {
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        for (int b = 0; b < SCREEN_WIDTH / 8; b++)
+            *observation++ = display->rows[y] >> (56 - b * 8);
+    }
+}
+
+// Each environment runs all its frames before the next one starts, so its VM stays in cache
+void Chip8Envs_step(Chip8Envs* envs, const uint16_t* actions, int frames, uint8_t* observations) {
+    for (int env = 0; env < envs->count; env++) {
+        VM* vm = envs->vms[env];
+        vm->keyboard.keys = actions[env];
+        for (int frame = 0; frame < frames && !vm->halted; frame++) {
+            VM_exec(vm, VM_frame_instructions(vm, envs->ips));
+            VM_tick_timers(vm);
+        }
+        if (observations)
+            observe(&vm->display, observations + env * CHIP8_OBSERVATION_SIZE);
+    }
+}
+
+VM* Chip8Envs_vm(Chip8Envs* envs, int env) {
+    return envs->vms[env];
+}
@@ -0,0 +1,37 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vm.h"
+#include "snapshot.h"
+
+// Bytes of one observation: the framebuffer packed 1 bit per pixel, rows top to bottom, MSB first
+#define CHIP8_OBSERVATION_SIZE (SCREEN_WIDTH * SCREEN_HEIGHT / 8)
+
+/*
+ * libchip8: a set of environments running the same ROM, for driving from another program (e.g.
+ * reinforcement learning). Every environment is a VM of its own, reset from one memory image
+ * taken when the set was created. Stepping doesn't allocate. Different sets share nothing and can
+ * be stepped from different threads.
+ */
+typedef struct Chip8Envs Chip8Envs;
+
+// `count` environments of `rom` running `ips` instructions per emulated second. NULL if count < 1.
+Chip8Envs* Chip8Envs_init(const uint8_t* rom, uint16_t size, int count, uint32_t ips);
+void Chip8Envs_free(Chip8Envs* envs);
+int Chip8Envs_count(Chip8Envs* envs);
+// Puts environment `env` back to power-on and seeds its random number generator (0 picks the default)
+void Chip8Envs_reset(Chip8Envs* envs, int env, uint32_t seed);
+/*
+ * Runs every environment for `frames` 60hz frames with the keys in its entry of `actions` held
+ * (bit k for key k). If `observations` isn't NULL the final framebuffer of environment e is
+ * written to observations + e * CHIP8_OBSERVATION_SIZE. Halted environments don't run.
+ */
+void Chip8Envs_step(Chip8Envs* envs, const uint16_t* actions, int frames, uint8_t* observations);
+// Makes environment `to` a copy of environment `from`, see VM_clone
+void Chip8Envs_clone(Chip8Envs* envs, int to, int from);
+// The VM of an environment, to read its memory, registers or halted flag
+VM* Chip8Envs_vm(Chip8Envs* envs, int env);
+
+#endif
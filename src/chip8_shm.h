@@ -0,0 +1,52 @@
+#ifndef CHIP8_SHM_H
+#define CHIP8_SHM_H
+
+#include <stdint.h>
+
+#define CHIP8_SHM_MAGIC 0x4D384843u  // "CH8M" in little-endian byte order
+#define CHIP8_SHM_VERSION 1
+
+/*
+ * Layout of the POSIX shared memory segment `chip8 --shm <name>` creates with shm_open(name), for
+ * programs that read frames or press keys without going through the window. Native byte order,
+ * every field at its natural alignment. This header has no other dependencies so it can be
+ * copied into other projects.
+ *
+ * The emulator publishes after every frame it presents, as a seqlock: `seq` is made odd, the
+ * fields from `frame` to `rows` are written, and `seq` is made even again with release ordering.
+ * A reader loads `seq` (acquire) and retries while it's odd, copies what it needs, issues an
+ * acquire fence and loads `seq` again; if it changed the copy may be torn and is retried. Every
+ * new frame adds 2 to `seq`, so a reader holding an even value can tell whether it has seen the
+ * latest frame.
+ *
+ * On Linux a reader can sleep until the next frame: atomically increment `waiters`, issue a
+ * sequentially consistent fence (__atomic_thread_fence(__ATOMIC_SEQ_CST)), call FUTEX_WAIT (not
+ * the private variant) on `seq` with the even value it last saw, then decrement `waiters`. The
+ * emulator stores `seq`, issues the same fence and only calls FUTEX_WAKE while `waiters` isn't 0;
+ * without the reader's fence a frame published meanwhile may not wake it. Elsewhere, poll `seq`.
+ *
+ * `input` is written by other programs: its low 16 bits are keys held (bit k for key k), or'ed
+ * with the keys of the front end when each frame starts. Store it atomically. The emulator
+ * unlinks the segment when it exits.
+ */
+typedef struct {
+    uint32_t magic;         // CHIP8_SHM_MAGIC, written before anything else is valid
+    uint16_t version;       // CHIP8_SHM_VERSION
+    uint16_t size;          // sizeof(Chip8Shm), later versions only append fields
+    uint32_t seq;           // seqlock sequence, odd while a frame is being written
+    uint32_t waiters;       // readers in FUTEX_WAIT on seq
+    // Written under the seqlock
+    uint64_t frame;         // 60hz frames run
+    uint64_t instructions;  // instructions executed
+    uint16_t keys;          // keys the VM saw this frame, from the front end and `input`
+    uint8_t delay;          // delay timer
+    uint8_t sound;          // sound timer, the tone plays while it's not 0
+    uint8_t halted;         // 1 once the VM hit an illegal instruction
+    uint8_t reserved[3];
+    uint64_t rows[32];      // framebuffer, one row of 64 pixels per word with bit 63 the leftmost
+    // Written by other programs
+    uint32_t input;         // keys to hold in the low 16 bits
+    uint32_t reserved2;
+} Chip8Shm;
+
+#endif
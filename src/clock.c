@@ -0,0 +1,29 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <time.h>
+#include "clock.h"
+
+uint64_t Clock_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+// Sleeps again when a signal (e.g. SIGUSR1 for a profile dump) wakes it up early
+void Clock_sleep_until(uint64_t deadline) {
+#if defined(__APPLE__)
+    // No clock_nanosleep, sleep for what's left until the deadline passed
+    for (uint64_t now = Clock_now_ns(); now < deadline; now = Clock_now_ns()) {
+        struct timespec ts;
+        ts.tv_sec = (deadline - now) / NS_PER_SEC;
+        ts.tv_nsec = (deadline - now) % NS_PER_SEC;
+        nanosleep(&ts, NULL);
+    }
+#else
+    struct timespec ts;
+    ts.tv_sec = deadline / NS_PER_SEC;
+    ts.tv_nsec = deadline % NS_PER_SEC;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        continue;
+#endif
+}
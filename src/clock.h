@@ -0,0 +1,15 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+#define NS_PER_US 1000ULL
+#define NS_PER_MS 1000000ULL
+#define NS_PER_SEC 1000000000ULL
+
+// Monotonic host time in nanoseconds. Only differences between readings are meaningful.
+uint64_t Clock_now_ns();
+// Blocks the calling thread until Clock_now_ns() >= deadline. Returns immediately if it already passed.
+void Clock_sleep_until(uint64_t deadline);
+
+#endif
@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <string.h>
+#include "cycles.h"
+
+static uint32_t* field(CycleCosts* costs, const char* name) {
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (op != OP_ILLEGAL && strcmp(name, op_names[op]) == 0)
+            return &costs->op[op];
+    }
+    if (strcmp(name, "fetch") == 0)
+        return &costs->fetch;
+    if (strcmp(name, "draw_row") == 0)
+        return &costs->draw_row;
+    if (strcmp(name, "frame") == 0)
+        return &costs->frame;
+    return NULL;
+}
+
+bool CycleCosts_load(CycleCosts* costs, const char* fpath) {
+    FILE* fd = fopen(fpath, "r");
+    if (fd == NULL) {
+        printf("No such file \"%s\"\n", fpath);
+        return false;
+    }
+
+    char line[256];
+    int number = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fd)) {
+        number++;
+        line[strcspn(line, "#\n")] = '\0';
+        char name[32];
+        unsigned long cycles;
+        char extra;
+        int found = sscanf(line, "%31s %lu %c", name, &cycles, &extra);
+        if (found <= 0)
+            continue;
+
+        uint32_t* value = field(costs, name);
+        if (found == 2 && strcmp(name, "vblank") == 0 && cycles <= 1) {
+            costs->vblank = cycles;
+        } else if (found == 2 && value) {
+            *value = cycles;
+        } else {
+            printf("%s:%d: expected an instruction or fetch, draw_row, frame or vblank and a number\n",
+                fpath, number);
+            ok = false;
+        }
+    }
+    fclose(fd);
+    // VM_exec_frame only ends a frame once instructions used up its budget
+    if (ok && (costs->frame == 0 || costs->fetch == 0)) {
+        printf("%s: frame and fetch must be at least 1 cycle\n", fpath);
+        ok = false;
+    }
+    return ok;
+}
@@ -0,0 +1,14 @@
+#ifndef CYCLES_H
+#define CYCLES_H
+
+#include <stdbool.h>
+#include "vm.h"
+
+/*
+ * Reads cycle costs from a text file over the ones already in `costs`, one "<name> <cycles>" per
+ * line with the names of op_names (e.g. "DRW 22") or fetch, draw_row, frame and vblank (0 or 1).
+ * Anything after a '#' is ignored. Prints the offending line and returns false on errors.
+ */
+bool CycleCosts_load(CycleCosts* costs, const char* fpath);
+
+#endif
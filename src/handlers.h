@@ -0,0 +1,48 @@
+#ifndef HANDLERS_H
+#define HANDLERS_H
+
+#include "vm.h"
+
+/*
+ * Instruction handlers from vm.c. They expect vm->pc to already point past the instruction.
+ * Exported so translated code can call the exact same semantics as the interpreter.
+ */
+void clear_screen(Inst* inst, VM* vm);
+void subroutine_return(Inst* inst, VM* vm);
+void jump(Inst* inst, VM* vm);
+void subroutine_call(Inst* inst, VM* vm);
+void skip_equal(Inst* inst, VM* vm);
+void skip_not_equal(Inst* inst, VM* vm);
+void skip_registers_equal(Inst* inst, VM* vm);
+void load_v(Inst* inst, VM* vm);
+void add(Inst* inst, VM* vm);
+void math_load(Inst* inst, VM* vm);
+void math_or(Inst* inst, VM* vm);
+void math_and(Inst* inst, VM* vm);
+void math_xor(Inst* inst, VM* vm);
+void math_add(Inst* inst, VM* vm);
+void math_sub(Inst* inst, VM* vm);
+void math_shr(Inst* inst, VM* vm);
+void math_subn(Inst* inst, VM* vm);
+void math_shl(Inst* inst, VM* vm);
+void math(Inst* inst, VM* vm);  // any 8XYN
+void illegal(Inst* inst, VM* vm);
+void skip_registers_not_equal(Inst* inst, VM* vm);
+void load_i(Inst* inst, VM* vm);
+void jump_offset(Inst* inst, VM* vm);
+void rnd(Inst* inst, VM* vm);
+void draw(Inst* inst, VM* vm);
+void skip_key_pressed(Inst* inst, VM* vm);
+void skip_key_not_pressed(Inst* inst, VM* vm);
+void load_delay(Inst* inst, VM* vm);
+void wait_key(Inst* inst, VM* vm);
+void set_delay(Inst* inst, VM* vm);
+void set_sound(Inst* inst, VM* vm);
+void add_i(Inst* inst, VM* vm);
+void load_font(Inst* inst, VM* vm);
+void store_bcd(Inst* inst, VM* vm);
+void store_registers(Inst* inst, VM* vm);
+void load_registers(Inst* inst, VM* vm);
+void f_family(Inst* inst, VM* vm);  // any FXNN
+
+#endif
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "input_log.h"
+
+/*
+ * File layout, little-endian: "CH8I", version (2 bytes), seed (4), ips (4), frames (8), event
+ * count (4), then per event the instructions since the previous event as a varint and the keys
+ * (2 bytes). From version 2, an ips of 0 is followed by the cycle costs before the events: fetch,
+ * draw_row and frame (4 each), vblank (1), the number of ops (1) and the cost of each op by Op (4).
+ */
+static const uint8_t magic[4] = { 'C', 'H', '8', 'I' };
+
+void InputLog_init(InputLog* log, uint32_t seed, uint32_t ips) {
+    memset(log, 0, sizeof(InputLog));
+    log->seed = seed;
+    log->ips = ips;
+    log->costs = vip_costs;
+}
+
+void InputLog_free(InputLog* log) {
+    free(log->events);
+    log->events = NULL;
+    log->count = log->capacity = log->next = 0;
+}
+
+void InputLog_record(InputLog* log, uint64_t instructions, uint16_t keys) {
+    uint16_t last = log->count ? log->events[log->count - 1].keys : 0;
+    if (keys == last)
+        return;
+
+    if (log->count == log->capacity) {
+        log->capacity = log->capacity ? log->capacity * 2 : 256;
+        log->events = realloc(log->events, log->capacity * sizeof(InputEvent));
+    }
+    log->events[log->count].instructions = instructions;
+    log->events[log->count].keys = keys;
+    log->count++;
+}
+
+uint16_t InputLog_replay(InputLog* log, uint64_t instructions, uint16_t keys) {
+    while (log->next < log->count && log->events[log->next].instructions <= instructions)
+        keys = log->events[log->next++].keys;
+    return keys;
+}
+
+static void put(FILE* fd, uint64_t value, int bytes) {
+    for (int b = 0; b < bytes; b++)
+        fputc(value >> (b * 8) & 0xFF, fd);
+}
+
+static uint64_t get(FILE* fd, int bytes) {
+    uint64_t value = 0;
+    for (int b = 0; b < bytes; b++)
+        value |= (uint64_t)(fgetc(fd) & 0xFF) << (b * 8);
+    return value;
+}
+
+bool InputLog_save(const InputLog* log, const char* fpath) {
+    FILE* fd = fopen(fpath, "wb");
+    if (fd == NULL)
+        return false;
+
+    fwrite(magic, 1, sizeof(magic), fd);
+    put(fd, INPUT_LOG_VERSION, 2);
+    put(fd, log->seed, 4);
+    put(fd, log->ips, 4);
+    put(fd, log->frames, 8);
+    put(fd, log->count, 4);
+    if (log->ips == 0) {
+        put(fd, log->costs.fetch, 4);
+        put(fd, log->costs.draw_row, 4);
+        put(fd, log->costs.frame, 4);
+        put(fd, log->costs.vblank, 1);
+        put(fd, OP_COUNT, 1);
+        for (int op = 0; op < OP_COUNT; op++)
+            put(fd, log->costs.op[op], 4);
+    }
+    uint64_t previous = 0;
+    for (size_t e = 0; e < log->count; e++) {
+        uint64_t delta = log->events[e].instructions - previous;
+        previous = log->events[e].instructions;
+        while (delta >= 0x80) {
+            fputc((delta & 0x7F) | 0x80, fd);
+            delta >>= 7;
+        }
+        fputc(delta, fd);
+        put(fd, log->events[e].keys, 2);
+    }
+    return fclose(fd) == 0;
+}
+
+bool InputLog_load(InputLog* log, const char* fpath) {
+    FILE* fd = fopen(fpath, "rb");
+    if (fd == NULL)
+        return false;
+
+    uint8_t header[sizeof(magic)];
+    uint16_t version = 0;
+    if (fread(header, 1, sizeof(header), fd) == sizeof(header) &&
+        memcmp(header, magic, sizeof(magic)) == 0)
+        version = get(fd, 2);
+    if (version < 1 || version > INPUT_LOG_VERSION) {
+        fclose(fd);
+        return false;
+    }
+    uint32_t seed = get(fd, 4);
+    uint32_t ips = get(fd, 4);
+    InputLog_init(log, seed, ips);
+    log->frames = get(fd, 8);
+    uint32_t count = get(fd, 4);
+    if (ips == 0 && version > 1) {
+        log->costs.fetch = get(fd, 4);
+        log->costs.draw_row = get(fd, 4);
+        log->costs.frame = get(fd, 4);
+        log->costs.vblank = get(fd, 1);
+        // Costs of ops this build doesn't know couldn't be replayed
+        if (get(fd, 1) != OP_COUNT) {
+            fclose(fd);
+            return false;
+        }
+        for (int op = 0; op < OP_COUNT; op++)
+            log->costs.op[op] = get(fd, 4);
+    }
+
+    uint64_t instructions = 0;
+    for (uint32_t e = 0; e < count && !feof(fd); e++) {
+        uint64_t delta = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            int byte = fgetc(fd);
+            delta |= (uint64_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                break;
+        }
+        instructions += delta;
+        InputLog_record(log, instructions, get(fd, 2));
+    }
+    bool complete = !feof(fd) && !ferror(fd);
+    fclose(fd);
+    return complete;
+}
@@ -0,0 +1,44 @@
+#ifndef INPUT_LOG_H
+#define INPUT_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "vm.h"
+
+#define INPUT_LOG_VERSION 2
+
+// The keypad changed to `keys` once `instructions` instructions had run
+typedef struct {
+    uint64_t instructions;
+    uint16_t keys;
+} InputEvent;
+
+/*
+ * Everything needed to reproduce a run from the ROM: the random seed, the speed, how many frames
+ * it lasted and every change of the keys held. VM_run applies input between frames, and frames
+ * run a fixed number of instructions for a given ips, so replaying the events at the same
+ * instruction counts replays the run exactly.
+ */
+typedef struct {
+    uint32_t seed;
+    uint32_t ips;  // 0 if frames ran on a cycle budget, see VM_exec_frame
+    CycleCosts costs;  // the budget and costs when ips is 0, vip_costs by default
+    uint64_t frames;
+    InputEvent* events;
+    size_t count;
+    size_t capacity;
+    size_t next;  // next event to replay
+} InputLog;
+
+void InputLog_init(InputLog* log, uint32_t seed, uint32_t ips);
+void InputLog_free(InputLog* log);
+// Appends an event if `keys` differs from the last one recorded
+void InputLog_record(InputLog* log, uint64_t instructions, uint16_t keys);
+// Keys held after replaying every event up to `instructions`, `keys` if there were none
+uint16_t InputLog_replay(InputLog* log, uint64_t instructions, uint16_t keys);
+bool InputLog_save(const InputLog* log, const char* fpath);
+// Reads version 1 logs too, which recorded no costs: the VIP's are assumed
+bool InputLog_load(InputLog* log, const char* fpath);
+
+#endif
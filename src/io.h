@@ -3,43 +3,31 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-#include <SDL2/SDL.h>
-
-#define SCREEN_SCALE 10
-#define SCREEN_WIDTH 64
-#define SCREEN_HEIGHT 32
-#define BUFFER_SIZE SCREEN_WIDTH * SCREEN_HEIGHT
-#define AUDIO_GAIN 2000
-
-typedef struct {
-    SDL_Window* window;
-    SDL_Surface* surface;
-    SDL_Palette* palette;
-    SDL_Surface* blit_surface;
-    SDL_Surface* draw_surface;
-    uint8_t buffer[BUFFER_SIZE];
-} Display;
-
-typedef struct {
-    SDL_AudioDeviceID audio_device;
-    SDL_AudioSpec audio_spec;
-} Audio;
-
-typedef struct {
-    bool input_active;
-    uint8_t input;
-} Keyboard;
-
-typedef struct {
-    Display* display;
-    Audio* audio;
-    Keyboard* keyboard;
-} IO;
-
-IO* IO_init();
+#include "vm.h"
+
+/*
+ * A front end presents the VM's framebuffer, plays its tone and feeds it input. The VM core
+ * never calls into a front end; the run loop does. `data` holds backend specific state.
+ */
+typedef struct IO IO;
+struct IO {
+    void* data;
+    // Returns false once the user asked to quit.
+    bool (*process_input)(IO* io, Keyboard* keyboard);
+    void (*render)(IO* io, const Display* display);
+    // Called on the frame the sound timer becomes active (on) and the frame it runs out.
+    void (*set_tone)(IO* io, bool on);
+    void (*free)(IO* io);
+    // Optional, blocks until Clock_now_ns() reaches deadline or input arrives, whichever is first
+    void (*wait)(IO* io, uint64_t deadline);
+    // Optional and safe to call from any thread, makes a wait in progress (or the next one) return
+    void (*wake)(IO* io);
+    bool rewind;  // set by the front end while the player holds the rewind key
+};
+
+IO* IO_init_sdl(int scale, int audio_samples);
+IO* IO_init_null();
+IO* IO_init_dump(const char* fpath);
 void IO_free(IO* io);
-void Display_render(Display* display);
-void Audio_play(Audio* audio);
-bool Keyboard_process_input(Keyboard* keyboard);
 
 #endif
@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDL2/SDL.h>
+#include "io.h"
+#include "clock.h"
+#include "synth.h"
+
+// gameboy colors (dark green and light green)
+#define COLOR_OFF 0xFF306230
+#define COLOR_ON 0xFF8BAC0F
+#define AUDIO_GAIN 2000
+
+typedef struct {
+    SDL_Window* window;
+    SDL_Renderer* renderer;
+    SDL_Texture* texture;   // SCREEN_WIDTH x SCREEN_HEIGHT ARGB8888, scaled by the renderer
+    PixelLUT lut;
+    bool exposed;           // the window needs presenting even if the frame didn't change
+    // Time spent in Display_render for frames that were presented
+    uint64_t presents;
+    uint64_t present_ns;
+    uint64_t present_max_ns;
+    // Latency probe: SDL time of a key press no changed frame was presented after yet, 0 if none
+    uint32_t probe_pressed;
+    uint64_t probes;
+    uint64_t probe_ms;
+    uint32_t probe_max_ms;
+} SDLDisplay;
+
+typedef struct {
+    SDL_AudioDeviceID audio_device;
+    SDL_AudioSpec audio_spec;
+    Synth synth;
+} Audio;
+
+typedef struct {
+    SDLDisplay display;
+    Audio audio;
+    Uint32 wake_event;  // pushed by sdl_wake, ignored by Keyboard_process_input
+    uint16_t tapped;    // keys released before they were down for a frame, see Keyboard_process_input
+} SDLIO;
+
+/*
+ * Presents the frame when it changed since the last one, or the window was exposed or resized.
+ * The band of rows between the first and last changed row is expanded straight into the
+ * streaming texture through the palette table, and the renderer does the nearest neighbour
+ * scaling to whatever size the window has.
+ */
+static void Display_render(SDLDisplay* display, const Display* frame) {
+    uint32_t rows = frame->dirty;
+    if (!rows && !display->exposed)
+        return;
+    display->exposed = false;
+    uint64_t start = Clock_now_ns();
+
+    if (rows) {
+        int top = 0;
+        int bottom = SCREEN_HEIGHT - 1;
+        while (!(rows >> top & 1))
+            top++;
+        while (!(rows >> bottom & 1))
+            bottom--;
+
+        SDL_Rect band = { 0, top, SCREEN_WIDTH, bottom - top + 1 };
+        void* pixels;
+        int pitch;
+        if (SDL_LockTexture(display->texture, &band, &pixels, &pitch) == 0) {
+            Display_expand(frame, display->lut, pixels, pitch, top, bottom);
+            SDL_UnlockTexture(display->texture);
+        }
+    }
+
+    SDL_RenderClear(display->renderer);
+    SDL_RenderCopy(display->renderer, display->texture, NULL, NULL);
+    SDL_RenderPresent(display->renderer);
+
+    // The first changed frame after a key press is the earliest the player can see an answer
+    if (rows && display->probe_pressed) {
+        uint32_t latency = SDL_GetTicks() - display->probe_pressed;
+        display->probes++;
+        display->probe_ms += latency;
+        if (latency > display->probe_max_ms)
+            display->probe_max_ms = latency;
+        display->probe_pressed = 0;
+    }
+
+    uint64_t elapsed = Clock_now_ns() - start;
+    display->presents++;
+    display->present_ns += elapsed;
+    if (elapsed > display->present_max_ns)
+        display->present_max_ns = elapsed;
+}
+
+// Runs on SDL's audio thread
+static void Audio_callback(void* userdata, Uint8* stream, int len) {
+    Audio* audio = userdata;
+    Synth_fill(&audio->synth, (int16_t*)stream, len / sizeof(int16_t));
+}
+
+#define KEYPAD 0x10  // marks the scancodes in keypad[] that are keypad keys
+
+/*
+ * Hex keypad key of each scancode, or'ed with KEYPAD, for the keys on the left of a QWERTY
+ * keyboard:
+ *   1 2 3 4      1 2 3 C
+ *   Q W E R  ->  4 5 6 D
+ *   A S D F      7 8 9 E
+ *   Z X C V      A 0 B F
+ */
+static const uint8_t keypad[SDL_NUM_SCANCODES] = {
+    [SDL_SCANCODE_1] = KEYPAD | 0x1, [SDL_SCANCODE_2] = KEYPAD | 0x2,
+    [SDL_SCANCODE_3] = KEYPAD | 0x3, [SDL_SCANCODE_4] = KEYPAD | 0xC,
+    [SDL_SCANCODE_Q] = KEYPAD | 0x4, [SDL_SCANCODE_W] = KEYPAD | 0x5,
+    [SDL_SCANCODE_E] = KEYPAD | 0x6, [SDL_SCANCODE_R] = KEYPAD | 0xD,
+    [SDL_SCANCODE_A] = KEYPAD | 0x7, [SDL_SCANCODE_S] = KEYPAD | 0x8,
+    [SDL_SCANCODE_D] = KEYPAD | 0x9, [SDL_SCANCODE_F] = KEYPAD | 0xE,
+    [SDL_SCANCODE_Z] = KEYPAD | 0xA, [SDL_SCANCODE_X] = KEYPAD | 0x0,
+    [SDL_SCANCODE_C] = KEYPAD | 0xB, [SDL_SCANCODE_V] = KEYPAD | 0xF,
+};
+
+/*
+ * Backspace is held to rewind. A key pressed and released between two calls stays down until the
+ * next call, `tapped` holds those keys, so the ROM gets at least one frame to see every press.
+ */
+static bool Keyboard_process_input(Keyboard* keyboard, SDLDisplay* display, bool* rewind, uint16_t* tapped) {
+    uint16_t pressed = 0;
+    keyboard->keys &= ~*tapped;
+    *tapped = 0;
+
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        switch (event.type) {
+            case SDL_QUIT:
+                return false;
+                break;
+            case SDL_WINDOWEVENT:
+                if (event.window.event == SDL_WINDOWEVENT_EXPOSED ||
+                    event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+                    display->exposed = true;
+                break;
+            case SDL_KEYDOWN:
+            case SDL_KEYUP: {
+                SDL_Scancode scancode = event.key.keysym.scancode;
+                uint8_t key = scancode >= 0 && scancode < SDL_NUM_SCANCODES ? keypad[scancode] : 0;
+                bool down = event.type == SDL_KEYDOWN;
+                if (scancode == SDL_SCANCODE_BACKSPACE) {
+                    *rewind = down;
+                } else if (key & KEYPAD) {
+                    uint16_t bit = 1 << (key & 0xF);
+                    if (down) {
+                        pressed |= bit;
+                        *tapped &= ~bit;
+                    } else if (pressed & bit) {
+                        *tapped |= bit;
+                        break;
+                    }
+                    Keyboard_set(keyboard, key & 0xF, down);
+                    if (down && !event.key.repeat && !display->probe_pressed)
+                        display->probe_pressed = event.key.timestamp ? event.key.timestamp : 1;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+static bool sdl_process_input(IO* io, Keyboard* keyboard) {
+    SDLIO* sdl = io->data;
+    return Keyboard_process_input(keyboard, &sdl->display, &io->rewind, &sdl->tapped);
+}
+
+static void sdl_render(IO* io, const Display* display) {
+    SDLIO* sdl = io->data;
+    Display_render(&sdl->display, display);
+}
+
+static void sdl_set_tone(IO* io, bool on) {
+    SDLIO* sdl = io->data;
+    Synth_set_tone(&sdl->audio.synth, on);
+}
+
+static void sdl_wait(IO* io, uint64_t deadline) {
+    for (;;) {
+        uint64_t now = Clock_now_ns();
+        if (now >= deadline)
+            return;
+        // Leaves the event in the queue for the next process_input
+        if (SDL_WaitEventTimeout(NULL, (deadline - now + NS_PER_MS - 1) / NS_PER_MS))
+            return;
+    }
+}
+
+// SDL_PushEvent is thread safe
+static void sdl_wake(IO* io) {
+    SDLIO* sdl = io->data;
+    SDL_Event event = { .type = sdl->wake_event };
+    SDL_PushEvent(&event);
+}
+
+static void sdl_free(IO* io) {
+    SDLIO* sdl = io->data;
+    SDLDisplay* display = &sdl->display;
+
+    if (display->presents) {
+        printf("Presented %llu frames, %.1fus average, %.1fus max\n",
+            (unsigned long long)display->presents,
+            (double)display->present_ns / display->presents / NS_PER_US,
+            (double)display->present_max_ns / NS_PER_US);
+    }
+
+    if (display->probes) {
+        printf("Key press to changed frame: %llu presses, %.1fms average, %ums max\n",
+            (unsigned long long)display->probes, (double)display->probe_ms / display->probes,
+            display->probe_max_ms);
+    }
+
+    if (display->texture)
+        SDL_DestroyTexture(display->texture);
+    if (display->renderer)
+        SDL_DestroyRenderer(display->renderer);
+    if (display->window)
+        SDL_DestroyWindow(display->window);
+    if (sdl->audio.audio_device)
+        SDL_CloseAudioDevice(sdl->audio.audio_device);
+
+    SDL_Quit();
+    free(sdl);
+}
+
+/*
+ * Opens a resizable window, initially `scale` times the CHIP-8 resolution, and an audio device
+ * pulling `audio_samples` samples per callback. Returns NULL (after printing why) if SDL can't
+ * provide either, so callers can fall back to a headless front end.
+ */
+IO* IO_init_sdl(int scale, int audio_samples) {
+    SDLIO* sdl = calloc(1, sizeof(SDLIO));
+    SDLDisplay* display = &sdl->display;
+    Audio* audio = &sdl->audio;
+    IO* io = calloc(1, sizeof(IO));
+
+    io->data = sdl;
+    io->process_input = sdl_process_input;
+    io->render = sdl_render;
+    io->set_tone = sdl_set_tone;
+    io->wait = sdl_wait;
+    io->free = sdl_free;
+
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
+        printf("Couldn't initialize SDL: %s\n", SDL_GetError());
+        IO_free(io);
+        return NULL;
+    };
+    sdl->wake_event = SDL_RegisterEvents(1);
+    if (sdl->wake_event != (Uint32)-1)
+        io->wake = sdl_wake;
+
+    display->window = SDL_CreateWindow(
+        "CHIP-8 Emulator",
+        SDL_WINDOWPOS_CENTERED,
+        SDL_WINDOWPOS_CENTERED,
+        SCREEN_WIDTH * scale,
+        SCREEN_HEIGHT * scale,
+        SDL_WINDOW_RESIZABLE
+    );
+    if (!display->window) {
+        printf("Failed to open window: %s\n", SDL_GetError());
+        IO_free(io);
+        return NULL;
+    }
+
+    display->renderer = SDL_CreateRenderer(display->window, -1, 0);
+    if (!display->renderer) {
+        printf("Failed to create renderer: %s\n", SDL_GetError());
+        IO_free(io);
+        return NULL;
+    }
+    // Keep the aspect ratio with nearest neighbour scaling whatever the window size
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+    SDL_RenderSetLogicalSize(display->renderer, SCREEN_WIDTH, SCREEN_HEIGHT);
+
+    display->texture = SDL_CreateTexture(display->renderer, SDL_PIXELFORMAT_ARGB8888,
+        SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
+    if (!display->texture) {
+        printf("Failed to create texture: %s\n", SDL_GetError());
+        IO_free(io);
+        return NULL;
+    }
+    PixelLUT_init(display->lut, COLOR_OFF, COLOR_ON);
+
+    audio->audio_spec.freq = 44100;
+    audio->audio_spec.format = AUDIO_S16SYS;
+    audio->audio_spec.channels = 1;  // mono
+    audio->audio_spec.samples = audio_samples;  // buffer size, about 11ms at the default 512
+    audio->audio_spec.callback = Audio_callback;
+    audio->audio_spec.userdata = audio;
+    Synth_init(&audio->synth, audio->audio_spec.freq, TONE_FREQUENCY, AUDIO_GAIN);
+
+    audio->audio_device = SDL_OpenAudioDevice(NULL, 0, &audio->audio_spec, NULL, 0);
+    if (audio->audio_device == 0) {
+        printf("Couldn't open audio device: %s\n", SDL_GetError());
+        IO_free(io);
+        return NULL;
+    }
+    SDL_PauseAudioDevice(audio->audio_device, 0);
+
+    return io;
+}
@@ -0,0 +1,565 @@
+#define _DEFAULT_SOURCE
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jit.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+
+#define CODE_SIZE (4 * 1024 * 1024)
+#define MAX_BLOCK_INSTRUCTIONS 128
+// Worst case is 128 Fx65s loading all 16 registers, about 330 bytes each
+#define MAX_BLOCK_CODE (64 * 1024)
+// Code that keeps rewriting itself is left to the interpreter
+#define MAX_REWRITES 2
+
+// x86 register numbers
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+
+#define V_OFF(x) (int32_t)(offsetof(VM, v) + (x))
+#define I_OFF (int32_t)offsetof(VM, i)
+#define PC_OFF (int32_t)offsetof(VM, pc)
+#define SP_OFF (int32_t)offsetof(VM, sp)
+#define STACK_OFF (int32_t)offsetof(VM, stack)
+#define DELAY_OFF (int32_t)offsetof(VM, delay)
+#define SOUND_OFF (int32_t)offsetof(VM, sound)
+#define MEMORY_OFF (int32_t)offsetof(VM, memory)
+
+/*
+ * Generated code runs with rbx = VM*, r12 = remaining instruction budget and r13 = where to
+ * store the budget on exit. Registers live in the VM struct and are used as [rbx + disp32]
+ * memory operands. Every exit leaves vm->pc set and returns the address of the rel32 to patch
+ * for chaining (or NULL for computed targets) through rax.
+ */
+typedef uint8_t* (*EnterFn)(VM* vm, uint8_t* code, int64_t budget, int64_t* remaining);
+
+struct JIT {
+    VM* vm;
+    uint8_t* code;
+    uint8_t* p;             // emit cursor
+    uint8_t* first_block;   // everything before this is the enter/exit trampoline
+    uint8_t* exit_common;
+    EnterFn enter;
+    uint8_t* blocks[MEMORY_SIZE];     // native entry point per CHIP-8 address
+    uint8_t interpret[MEMORY_SIZE];   // first instruction at this address can't be compiled
+    uint8_t covered[MEMORY_SIZE];     // byte is part of a compiled block
+    uint8_t rewrites[MEMORY_SIZE];    // times a store to this byte threw compiled code away
+    uint64_t epoch;         // vm->cache.invalidations last time the dirty range was checked
+    JITStats stats;
+};
+
+static void emit8(JIT* jit, uint8_t b) {
+    *jit->p++ = b;
+}
+
+static void emit16(JIT* jit, uint16_t v) {
+    memcpy(jit->p, &v, 2);
+    jit->p += 2;
+}
+
+static void emit32(JIT* jit, uint32_t v) {
+    memcpy(jit->p, &v, 4);
+    jit->p += 4;
+}
+
+static void emit64(JIT* jit, uint64_t v) {
+    memcpy(jit->p, &v, 8);
+    jit->p += 8;
+}
+
+static void emit_bytes(JIT* jit, const uint8_t* bytes, size_t len) {
+    memcpy(jit->p, bytes, len);
+    jit->p += len;
+}
+
+// opcode + ModRM for [rbx + disp32]
+static void emit_mem(JIT* jit, uint8_t opcode, uint8_t reg, int32_t disp) {
+    emit8(jit, opcode);
+    emit8(jit, 0x80 | reg << 3 | RBX);
+    emit32(jit, disp);
+}
+
+static void emit_load8(JIT* jit, uint8_t reg, int32_t disp) {
+    emit_mem(jit, 0x8A, reg, disp);
+}
+
+static void emit_store8(JIT* jit, uint8_t reg, int32_t disp) {
+    emit_mem(jit, 0x88, reg, disp);
+}
+
+static void emit_store_imm8(JIT* jit, int32_t disp, uint8_t value) {
+    emit_mem(jit, 0xC6, 0, disp);
+    emit8(jit, value);
+}
+
+static void emit_store_imm16(JIT* jit, int32_t disp, uint16_t value) {
+    emit8(jit, 0x66);
+    emit_mem(jit, 0xC7, 0, disp);
+    emit16(jit, value);
+}
+
+static void emit_movzx8(JIT* jit, int32_t disp) {
+    emit8(jit, 0x0F);
+    emit_mem(jit, 0xB6, RAX, disp);
+}
+
+static void emit_jmp(JIT* jit, uint8_t* target) {
+    emit8(jit, 0xE9);
+    emit32(jit, (uint32_t)(target - (jit->p + 4)));
+}
+
+// The code buffer is mapped either writable or executable, never both
+static bool set_writable(JIT* jit, bool writable) {
+    return mprotect(jit->code, CODE_SIZE, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+}
+
+static void patch_rel32(uint8_t* site, uint8_t* target) {
+    int32_t rel = (int32_t)(target - (site + 4));
+    memcpy(site, &rel, 4);
+}
+
+/*
+ * Leaves for a known address. The jmp initially falls through to a stub that stores pc and
+ * returns to the dispatcher, which later points it straight at the target block.
+ */
+static void emit_static_exit(JIT* jit, uint16_t target) {
+    emit8(jit, 0xE9);
+    uint8_t* site = jit->p;
+    emit32(jit, 0);
+
+    if (target < MEMORY_SIZE && jit->blocks[target]) {
+        patch_rel32(site, jit->blocks[target]);
+        jit->stats.chained++;
+    }
+
+    emit_store_imm16(jit, PC_OFF, target);
+    emit8(jit, 0x48);   // mov rax, site
+    emit8(jit, 0xB8);
+    emit64(jit, (uint64_t)(uintptr_t)site);
+    emit_jmp(jit, jit->exit_common);
+}
+
+// Leaves for the address in ax
+static void emit_dynamic_exit(JIT* jit) {
+    emit8(jit, 0x66);   // mov [rbx + pc], ax
+    emit_mem(jit, 0x89, RAX, PC_OFF);
+    emit8(jit, 0x31);   // xor eax, eax
+    emit8(jit, 0xC0);
+    emit_jmp(jit, jit->exit_common);
+}
+
+// Two exits: pc + 2 when the condition in `jcc` doesn't hold, pc + 4 when it does
+static void emit_skip(JIT* jit, uint8_t jcc, uint16_t next) {
+    emit8(jit, 0x0F);
+    emit8(jit, jcc);
+    uint8_t* taken = jit->p;
+    emit32(jit, 0);
+    emit_static_exit(jit, next);
+    patch_rel32(taken, jit->p);
+    emit_static_exit(jit, next + 2);
+}
+
+// rax = stack slot index (sp % STACK_SIZE)
+static void emit_stack_index(JIT* jit) {
+    emit8(jit, 0x0F);
+    emit_mem(jit, 0xB6, RAX, SP_OFF);
+    static const uint8_t and_eax_15[] = {0x83, 0xE0, 0x0F};
+    emit_bytes(jit, and_eax_15, sizeof(and_eax_15));
+}
+
+static bool is_terminator(uint8_t op) {
+    switch (op) {
+        case OP_JP: case OP_CALL: case OP_RET: case OP_JP_V0:
+        case OP_SE: case OP_SNE: case OP_SVE: case OP_SVNE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool is_supported(uint8_t op) {
+    switch (op) {
+        case OP_LD_V: case OP_ADD: case OP_MOV: case OP_OR: case OP_AND: case OP_XOR:
+        case OP_ADD_V: case OP_SUB: case OP_SHR: case OP_SUBN: case OP_SHL: case OP_LD_I:
+        case OP_LD_VDT: case OP_LD_DT: case OP_LD_ST: case OP_ADD_I: case OP_LD_F: case OP_LOAD:
+            return true;
+        default:
+            return is_terminator(op);
+    }
+}
+
+// Emits `inst`, located at addr. Terminators emit their own exits.
+static void emit_inst(JIT* jit, Inst* inst, uint16_t addr) {
+    uint16_t next = addr + 2;
+    int32_t vx = V_OFF(inst->x);
+    int32_t vy = V_OFF(inst->y);
+    int32_t vf = V_OFF(0x0F);
+
+    switch (inst->op) {
+        case OP_LD_V:
+            emit_store_imm8(jit, vx, inst->nn);
+            break;
+        case OP_ADD:
+            emit_mem(jit, 0x80, 0, vx);   // add byte [vx], nn
+            emit8(jit, inst->nn);
+            break;
+        case OP_MOV:
+            emit_load8(jit, RAX, vy);
+            emit_store8(jit, RAX, vx);
+            break;
+        case OP_OR:
+        case OP_AND:
+        case OP_XOR:
+            emit_load8(jit, RAX, vx);
+            emit_mem(jit, inst->op == OP_OR ? 0x0A : inst->op == OP_AND ? 0x22 : 0x32, RAX, vy);
+            emit_store8(jit, RAX, vx);
+            emit_store_imm8(jit, vf, 0);
+            break;
+        case OP_ADD_V: {
+            static const uint8_t setc_cl[] = {0x0F, 0x92, 0xC1};
+            emit_load8(jit, RAX, vx);
+            emit_mem(jit, 0x02, RAX, vy);   // add al, [vy]
+            emit_bytes(jit, setc_cl, sizeof(setc_cl));
+            emit_store8(jit, RAX, vx);
+            emit_store8(jit, RCX, vf);
+            break;
+        }
+        case OP_SUB:
+        case OP_SUBN: {
+            // cmp al, dl; seta cl; sub al, dl
+            static const uint8_t sub[] = {0x38, 0xD0, 0x0F, 0x97, 0xC1, 0x28, 0xD0};
+            emit_load8(jit, RAX, inst->op == OP_SUB ? vx : vy);
+            emit_load8(jit, RDX, inst->op == OP_SUB ? vy : vx);
+            emit_bytes(jit, sub, sizeof(sub));
+            emit_store8(jit, RAX, vx);
+            emit_store8(jit, RCX, vf);
+            break;
+        }
+        case OP_SHR: {
+            // mov cl, al; and cl, 1; shr al, 1
+            static const uint8_t shr[] = {0x88, 0xC1, 0x80, 0xE1, 0x01, 0xD0, 0xE8};
+            emit_load8(jit, RAX, vy);
+            emit_bytes(jit, shr, sizeof(shr));
+            emit_store8(jit, RAX, vx);
+            emit_store8(jit, RCX, vf);
+            break;
+        }
+        case OP_SHL: {
+            // mov cl, al; shr cl, 7; add al, al
+            static const uint8_t shl[] = {0x88, 0xC1, 0xC0, 0xE9, 0x07, 0x00, 0xC0};
+            emit_load8(jit, RAX, vy);
+            emit_bytes(jit, shl, sizeof(shl));
+            emit_store8(jit, RAX, vx);
+            emit_store8(jit, RCX, vf);
+            break;
+        }
+        case OP_LD_I:
+            emit_store_imm16(jit, I_OFF, inst->nnn);
+            break;
+        case OP_LD_VDT:
+            emit_load8(jit, RAX, DELAY_OFF);
+            emit_store8(jit, RAX, vx);
+            break;
+        case OP_LD_DT:
+        case OP_LD_ST:
+            emit_load8(jit, RAX, vx);
+            emit_store8(jit, RAX, inst->op == OP_LD_DT ? DELAY_OFF : SOUND_OFF);
+            break;
+        case OP_ADD_I:
+            emit_movzx8(jit, vx);
+            emit8(jit, 0x66);   // add [i], ax
+            emit_mem(jit, 0x01, RAX, I_OFF);
+            emit8(jit, 0x66);   // test word [i], 0xF000
+            emit_mem(jit, 0xF7, 0, I_OFF);
+            emit16(jit, 0xF000);
+            emit8(jit, 0x74);   // jz over the next 7 byte store
+            emit8(jit, 0x07);
+            emit_store_imm8(jit, vf, 1);
+            break;
+        case OP_LD_F: {
+            // and eax, 15; lea eax, [rax + rax * 4]
+            static const uint8_t times5[] = {0x83, 0xE0, 0x0F, 0x8D, 0x04, 0x80};
+            emit_movzx8(jit, vx);
+            emit_bytes(jit, times5, sizeof(times5));
+            emit8(jit, 0x66);   // mov [i], ax
+            emit_mem(jit, 0x89, RAX, I_OFF);
+            break;
+        }
+        case OP_LOAD: {
+            // mov edx, eax; and edx, ADDR_MASK; mov cl, [rbx + rdx + memory]
+            static const uint8_t load[] = {0x89, 0xC2, 0x81, 0xE2, 0xFF, 0x0F, 0x00, 0x00, 0x8A, 0x8C, 0x13};
+            static const uint8_t inc_eax[] = {0xFF, 0xC0};
+            emit8(jit, 0x0F);   // movzx eax, word [i]
+            emit_mem(jit, 0xB7, RAX, I_OFF);
+            for (int k = 0; k <= inst->x; k++) {
+                emit_bytes(jit, load, sizeof(load));
+                emit32(jit, MEMORY_OFF);
+                emit_store8(jit, RCX, V_OFF(k));
+                emit_bytes(jit, inc_eax, sizeof(inc_eax));
+            }
+            emit8(jit, 0x66);   // mov [i], ax
+            emit_mem(jit, 0x89, RAX, I_OFF);
+            break;
+        }
+        case OP_JP:
+            emit_static_exit(jit, inst->nnn);
+            break;
+        case OP_CALL:
+            emit_stack_index(jit);
+            // mov word [rbx + rax * 2 + stack], next
+            emit8(jit, 0x66);
+            emit8(jit, 0xC7);
+            emit8(jit, 0x84);
+            emit8(jit, 0x43);
+            emit32(jit, STACK_OFF);
+            emit16(jit, next);
+            emit_mem(jit, 0xFE, 0, SP_OFF);   // inc byte [sp]
+            emit_static_exit(jit, inst->nnn);
+            break;
+        case OP_RET:
+            emit_mem(jit, 0xFE, 1, SP_OFF);   // dec byte [sp]
+            emit_stack_index(jit);
+            // movzx eax, word [rbx + rax * 2 + stack]
+            emit8(jit, 0x0F);
+            emit8(jit, 0xB7);
+            emit8(jit, 0x84);
+            emit8(jit, 0x43);
+            emit32(jit, STACK_OFF);
+            emit_dynamic_exit(jit);
+            break;
+        case OP_JP_V0:
+            emit_movzx8(jit, V_OFF(0));
+            emit8(jit, 0x05);   // add eax, nnn
+            emit32(jit, inst->nnn);
+            emit_dynamic_exit(jit);
+            break;
+        case OP_SE:
+        case OP_SNE:
+            emit_mem(jit, 0x80, 7, vx);   // cmp byte [vx], nn
+            emit8(jit, inst->nn);
+            emit_skip(jit, inst->op == OP_SE ? 0x84 : 0x85, next);
+            break;
+        case OP_SVE:
+        case OP_SVNE:
+            emit_load8(jit, RAX, vx);
+            emit_mem(jit, 0x3A, RAX, vy);   // cmp al, [vy]
+            emit_skip(jit, inst->op == OP_SVE ? 0x84 : 0x85, next);
+            break;
+    }
+}
+
+static void flush(JIT* jit) {
+    jit->p = jit->first_block;
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    memset(jit->interpret, 0, sizeof(jit->interpret));
+    memset(jit->covered, 0, sizeof(jit->covered));
+    jit->stats.flushes++;
+}
+
+/*
+ * Stores only happen in the interpreter, between blocks. If one of them hit compiled code,
+ * throw all of it away since chained jumps make single blocks hard to unlink.
+ */
+static void check_stores(JIT* jit) {
+    DecodeCache* cache = &jit->vm->cache;
+    if (cache->invalidations == jit->epoch)
+        return;
+
+    bool hit = false;
+    for (int addr = cache->dirty_lo; addr <= cache->dirty_hi && addr < MEMORY_SIZE; addr++) {
+        if (jit->covered[addr]) {
+            hit = true;
+            if (jit->rewrites[addr] < MAX_REWRITES)
+                jit->rewrites[addr]++;
+        }
+    }
+    if (hit)
+        flush(jit);
+
+    jit->epoch = cache->invalidations;
+    cache->dirty_lo = MEMORY_SIZE;
+    cache->dirty_hi = 0;
+}
+
+/*
+ * Compiles the block starting at `start`. A block ends after a jump, call, return or skip,
+ * before the first instruction the JIT can't translate, or after MAX_BLOCK_INSTRUCTIONS.
+ * Returns NULL if the very first instruction can't be translated.
+ */
+static uint8_t* compile(JIT* jit, uint16_t start) {
+    VM* vm = jit->vm;
+    uint16_t addr = start;
+    int32_t count = 0;
+    bool terminated = false;
+
+    while (count < MAX_BLOCK_INSTRUCTIONS && addr < ADDR_MASK) {
+        Inst* inst = VM_decode_at(vm, addr);
+        if (!is_supported(inst->op))
+            break;
+        if (jit->rewrites[addr] >= MAX_REWRITES || jit->rewrites[addr + 1] >= MAX_REWRITES)
+            break;
+        count++;
+        if (is_terminator(inst->op)) {
+            terminated = true;
+            break;
+        }
+        addr += 2;
+    }
+
+    if (count == 0) {
+        jit->interpret[start] = 1;
+        return NULL;
+    }
+
+    if (jit->code + CODE_SIZE - jit->p < MAX_BLOCK_CODE)
+        flush(jit);
+
+    set_writable(jit, true);
+    uint8_t* entry = jit->p;
+    jit->blocks[start] = entry;
+    memset(jit->covered + start, 1, count * 2);
+
+    // cmp r12, count; jl bail; sub r12, count
+    emit8(jit, 0x49);
+    emit8(jit, 0x81);
+    emit8(jit, 0xFC);
+    emit32(jit, count);
+    emit8(jit, 0x0F);
+    emit8(jit, 0x8C);
+    uint8_t* bail = jit->p;
+    emit32(jit, 0);
+    emit8(jit, 0x49);
+    emit8(jit, 0x81);
+    emit8(jit, 0xEC);
+    emit32(jit, count);
+
+    addr = start;
+    for (int n = 0; n < count; n++, addr += 2)
+        emit_inst(jit, VM_decode_at(vm, addr), addr);
+    if (!terminated)
+        emit_static_exit(jit, addr);
+
+    // Not enough budget left for the whole block, let the interpreter finish the batch
+    patch_rel32(bail, jit->p);
+    emit_store_imm16(jit, PC_OFF, start);
+    emit8(jit, 0x31);   // xor eax, eax
+    emit8(jit, 0xC0);
+    emit_jmp(jit, jit->exit_common);
+    set_writable(jit, false);
+
+    jit->stats.blocks++;
+    return entry;
+}
+
+static uint8_t* lookup(JIT* jit, uint16_t addr) {
+    if (jit->blocks[addr] || jit->interpret[addr])
+        return jit->blocks[addr];
+    return compile(jit, addr);
+}
+
+JIT* JIT_init(VM* vm) {
+    uint8_t* code = mmap(NULL, CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+        return NULL;
+
+    JIT* jit = calloc(1, sizeof(JIT));
+    jit->vm = vm;
+    jit->code = code;
+    jit->p = code;
+
+    // push rbx; push r12; push r13; mov rbx, rdi; mov r12, rdx; mov r13, rcx; jmp rsi
+    static const uint8_t enter[] = {
+        0x53, 0x41, 0x54, 0x41, 0x55, 0x48, 0x89, 0xFB, 0x49, 0x89, 0xD4, 0x49, 0x89, 0xCD, 0xFF, 0xE6
+    };
+    // mov [r13], r12; pop r13; pop r12; pop rbx; ret
+    static const uint8_t leave[] = {0x4D, 0x89, 0x65, 0x00, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3};
+
+    jit->enter = (EnterFn)(uintptr_t)jit->p;
+    emit_bytes(jit, enter, sizeof(enter));
+    jit->exit_common = jit->p;
+    emit_bytes(jit, leave, sizeof(leave));
+    jit->first_block = jit->p;
+    if (!set_writable(jit, false)) {
+        JIT_free(jit);
+        return NULL;
+    }
+
+    flush(jit);
+    jit->stats.flushes = 0;
+    jit->epoch = vm->cache.invalidations;
+    vm->cache.dirty_lo = MEMORY_SIZE;
+    vm->cache.dirty_hi = 0;
+    return jit;
+}
+
+void JIT_free(JIT* jit) {
+    munmap(jit->code, CODE_SIZE);
+    free(jit);
+}
+
+void JIT_exec(JIT* jit, uint32_t count) {
+    VM* vm = jit->vm;
+    int64_t remaining = count;
+
+    while (remaining > 0) {
+        check_stores(jit);
+
+        // Blocks are compiled for addresses inside memory, a pc past 0xFFF (after BNNN) is
+        // interpreted so it keeps counting up from there like it does in VM_exec
+        uint8_t* code = vm->pc < MEMORY_SIZE ? lookup(jit, vm->pc) : NULL;
+        int64_t left = remaining;
+
+        if (code) {
+            uint8_t* site = jit->enter(vm, code, remaining, &left);
+            vm->instructions += remaining - left;
+
+            if (site && left > 0 && vm->pc < MEMORY_SIZE) {
+                uint64_t flushes = jit->stats.flushes;
+                uint8_t* target = lookup(jit, vm->pc);
+                if (target && flushes == jit->stats.flushes) {
+                    set_writable(jit, true);
+                    patch_rel32(site, target);
+                    set_writable(jit, false);
+                    jit->stats.chained++;
+                }
+            }
+        }
+
+        if (left == remaining) {
+            // Untranslatable instruction, or a block longer than the remaining budget
+            VM_exec(vm, 1);
+            jit->stats.interpreted++;
+            left--;
+        }
+        remaining = left;
+    }
+}
+
+JITStats JIT_stats(JIT* jit) {
+    return jit->stats;
+}
+
+#else
+
+JIT* JIT_init(VM* vm) {
+    return NULL;
+}
+
+void JIT_free(JIT* jit) {
+}
+
+void JIT_exec(JIT* jit, uint32_t count) {
+}
+
+JITStats JIT_stats(JIT* jit) {
+    JITStats stats = {0};
+    return stats;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vm.h"
+
+/*
+ * Basic block recompiler for x86-64. Blocks of CHIP-8 code are translated to native code the
+ * first time they run and chained to each other with direct jumps. Instructions the JIT doesn't
+ * translate (DXYN, Fx0A, stores, ...) are run by the interpreter between blocks.
+ */
+typedef struct JIT JIT;
+
+typedef struct {
+    uint64_t blocks;        // blocks compiled
+    uint64_t chained;       // block exits patched to jump straight to their target
+    uint64_t flushes;       // code buffer resets, after self-modifying code or when full
+    uint64_t interpreted;   // instructions run by the interpreter fallback
+} JITStats;
+
+// Returns NULL if the host isn't supported or executable memory isn't available.
+JIT* JIT_init(VM* vm);
+void JIT_free(JIT* jit);
+// Same contract as VM_exec: runs exactly `count` instructions.
+void JIT_exec(JIT* jit, uint32_t count);
+JITStats JIT_stats(JIT* jit);
+
+#endif
@@ -0,0 +1,339 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdlib.h>
+#include <string.h>
+#include "lockstep.h"
+
+/*
+ * GCC/clang vector extensions, which compile to SSE2 on any x86-64 and to AVX2 with -mavx2.
+ * Comparisons give 0 or all ones per lane, which doubles as the lane masks.
+ */
+typedef uint8_t u8v __attribute__((vector_size(LOCKSTEP_LANES)));
+typedef int8_t i8v __attribute__((vector_size(LOCKSTEP_LANES)));
+typedef uint16_t u16v __attribute__((vector_size(LOCKSTEP_LANES * 2)));
+typedef int16_t i16v __attribute__((vector_size(LOCKSTEP_LANES * 2)));
+
+#define BLEND(mask, a, b) (((a) & (mask)) | ((b) & ~(mask)))
+#define SPLAT8(x) ((u8v){ 0 } + (uint8_t)(x))
+#define SPLAT16(x) ((u16v){ 0 } + (uint16_t)(x))
+// 8-bit lane mask to 16-bit lanes, all ones stays all ones
+#define WIDEN(mask) ((u16v)__builtin_convertvector((i8v)(mask), i16v))
+
+// Registers are plain arrays so single lanes can be read and written cheaply, vector code copies them in and out
+struct Lockstep {
+    uint8_t v[16][LOCKSTEP_LANES] __attribute__((aligned(32)));
+    uint16_t i[LOCKSTEP_LANES] __attribute__((aligned(32)));
+    uint16_t pc[LOCKSTEP_LANES] __attribute__((aligned(32)));
+    VM* vms[LOCKSTEP_LANES];
+    int count;
+    // Bytes that may differ between lanes, code there is compared before it is issued
+    uint8_t written[MEMORY_SIZE];
+    LockstepStats stats;
+};
+
+static inline bool any(u8v mask) {
+    uint64_t words[LOCKSTEP_LANES / 8];
+    uint64_t bits = 0;
+    memcpy(words, &mask, sizeof(mask));
+    for (int w = 0; w < LOCKSTEP_LANES / 8; w++)
+        bits |= words[w];
+    return bits != 0;
+}
+
+static void load_lane(Lockstep* ls, int lane) {
+    VM* vm = ls->vms[lane];
+    for (int r = 0; r < 16; r++)
+        ls->v[r][lane] = vm->v[r];
+    ls->i[lane] = vm->i;
+    ls->pc[lane] = vm->pc;
+}
+
+static void store_lane(Lockstep* ls, int lane) {
+    VM* vm = ls->vms[lane];
+    for (int r = 0; r < 16; r++)
+        vm->v[r] = ls->v[r][lane];
+    vm->i = ls->i[lane];
+    vm->pc = ls->pc[lane];
+}
+
+// Marks every byte where some lane's memory differs from the first one's, when lanes start out
+// different or after they ran on their own
+static void mark_differences(Lockstep* ls) {
+    const uint8_t* first = ls->vms[0]->memory;
+    for (int lane = 1; lane < ls->count; lane++) {
+        const uint8_t* memory = ls->vms[lane]->memory;
+        for (int block = 0; block < MEMORY_SIZE; block += 64) {
+            if (memcmp(memory + block, first + block, 64) == 0)
+                continue;
+            for (int addr = block; addr < block + 64; addr++)
+                ls->written[addr] |= memory[addr] != first[addr];
+        }
+    }
+}
+
+Lockstep* Lockstep_init(VM** vms, int count) {
+    void* memory;
+    if (count < 1 || count > LOCKSTEP_LANES || posix_memalign(&memory, sizeof(u16v), sizeof(Lockstep)) != 0)
+        return NULL;
+
+    Lockstep* ls = memory;
+    memset(ls, 0, sizeof(Lockstep));
+    memcpy(ls->vms, vms, count * sizeof(VM*));
+    ls->count = count;
+    mark_differences(ls);
+    return ls;
+}
+
+void Lockstep_free(Lockstep* lockstep) {
+    free(lockstep);
+}
+
+LockstepStats Lockstep_stats(Lockstep* lockstep) {
+    return lockstep->stats;
+}
+
+// Active lanes whose copy of the instruction at pc matches the one of lane `lead`
+static u8v same_code(Lockstep* ls, u8v active, int lead, uint16_t pc) {
+    const uint8_t* code = ls->vms[lead]->memory;
+    uint16_t next = (pc + 1) & ADDR_MASK;
+    for (int lane = 0; lane < ls->count; lane++) {
+        const uint8_t* memory = ls->vms[lane]->memory;
+        if (memory[pc & ADDR_MASK] != code[pc & ADDR_MASK] || memory[next] != code[next])
+            active[lane] = 0;
+    }
+    return active;
+}
+
+// Runs one instruction on every lane of `active` through the interpreter
+static void interpret(Lockstep* ls, Inst* inst, u8v active, uint32_t* scalar) {
+    for (int lane = 0; lane < ls->count; lane++) {
+        if (!active[lane])
+            continue;
+
+        VM* vm = ls->vms[lane];
+        store_lane(ls, lane);
+        if (inst->op == OP_STORE || inst->op == OP_BCD) {
+            int length = inst->op == OP_STORE ? inst->x + 1 : 3;
+            for (int b = 0; b < length; b++)
+                ls->written[(vm->i + b) & ADDR_MASK] = 1;
+        }
+        VM_tick(vm);
+        load_lane(ls, lane);
+        scalar[lane]++;
+    }
+}
+
+// Ops issue() runs as vector code
+static const bool vectorized[OP_COUNT] = {
+    [OP_JP] = true, [OP_SE] = true, [OP_SNE] = true, [OP_SVE] = true, [OP_LD_V] = true,
+    [OP_ADD] = true, [OP_MOV] = true, [OP_OR] = true, [OP_AND] = true, [OP_XOR] = true,
+    [OP_ADD_V] = true, [OP_SUB] = true, [OP_SHR] = true, [OP_SUBN] = true, [OP_SHL] = true,
+    [OP_SVNE] = true, [OP_LD_I] = true, [OP_ADD_I] = true
+};
+
+// Vectorized ops that write VF after Vx
+static const bool sets_flag[OP_COUNT] = {
+    [OP_OR] = true, [OP_AND] = true, [OP_XOR] = true, [OP_ADD_V] = true, [OP_SUB] = true,
+    [OP_SHR] = true, [OP_SUBN] = true, [OP_SHL] = true, [OP_ADD_I] = true
+};
+
+/*
+ * Executes `inst` on the active lanes, all at the same pc. Returns true if they are still all
+ * at the same pc afterwards.
+ */
+static bool issue(Lockstep* ls, Inst* inst, u8v m8, uint16_t pc, int lead, uint32_t* scalar) {
+    u16v m16 = WIDEN(m8);
+    u8v vx, vy, vf, skip;
+    u16v pcs;
+    memcpy(&vx, ls->v[inst->x], sizeof(vx));
+    memcpy(&vy, ls->v[inst->y], sizeof(vy));
+    memcpy(&vf, ls->v[0xF], sizeof(vf));
+    memcpy(&pcs, ls->pc, sizeof(pcs));
+    u8v out = vx;
+    u8v flag = vf;
+
+    switch (inst->op) {
+        case OP_LD_V: out = SPLAT8(inst->nn); break;
+        case OP_ADD: out = vx + inst->nn; break;
+        case OP_MOV: out = vy; break;
+        case OP_OR: out = vx | vy; flag = SPLAT8(0); break;
+        case OP_AND: out = vx & vy; flag = SPLAT8(0); break;
+        case OP_XOR: out = vx ^ vy; flag = SPLAT8(0); break;
+        case OP_ADD_V: out = vx + vy; flag = (u8v)(out < vx) & 1; break;
+        case OP_SUB: out = vx - vy; flag = (u8v)(vx > vy) & 1; break;
+        case OP_SHR: out = vy >> 1; flag = vy & 1; break;
+        case OP_SUBN: out = vy - vx; flag = (u8v)(vy > vx) & 1; break;
+        case OP_SHL: out = vy << 1; flag = vy >> 7; break;
+        case OP_LD_I: {
+            u16v i;
+            memcpy(&i, ls->i, sizeof(i));
+            i = BLEND(m16, SPLAT16(inst->nnn), i);
+            memcpy(ls->i, &i, sizeof(i));
+            break;
+        }
+        case OP_ADD_I: {
+            u16v i;
+            memcpy(&i, ls->i, sizeof(i));
+            i = BLEND(m16, i + __builtin_convertvector(vx, u16v), i);
+            memcpy(ls->i, &i, sizeof(i));
+            u8v overflow = (u8v)__builtin_convertvector((i16v)((i & 0xF000) != 0), i8v);
+            flag = BLEND(overflow, SPLAT8(1), vf);
+            break;
+        }
+        case OP_JP:
+            pcs = BLEND(m16, SPLAT16(inst->nnn), pcs);
+            memcpy(ls->pc, &pcs, sizeof(pcs));
+            return true;
+        case OP_SE: skip = (u8v)(vx == SPLAT8(inst->nn)); goto skip;
+        case OP_SNE: skip = (u8v)(vx != SPLAT8(inst->nn)); goto skip;
+        case OP_SVE: skip = (u8v)(vy == vx); goto skip;
+        case OP_SVNE: skip = (u8v)(vy != vx); goto skip;
+        default:
+            interpret(ls, inst, m8, scalar);
+            memcpy(&pcs, ls->pc, sizeof(pcs));
+            return !any(m8 & (u8v)__builtin_convertvector(pcs != SPLAT16(ls->pc[lead]), i8v));
+    }
+
+    // Vx is written before VF, which matters for 8FYN
+    out = BLEND(m8, out, vx);
+    memcpy(ls->v[inst->x], &out, sizeof(out));
+    if (sets_flag[inst->op]) {
+        memcpy(&vf, ls->v[0xF], sizeof(vf));
+        vf = BLEND(m8, flag, vf);
+        memcpy(ls->v[0xF], &vf, sizeof(vf));
+    }
+
+    pcs = BLEND(m16, SPLAT16(pc + 2), pcs);
+    memcpy(ls->pc, &pcs, sizeof(pcs));
+    return true;
+
+skip:
+    pcs = BLEND(m16, SPLAT16(pc + 2) + (WIDEN(skip) & 2), pcs);
+    memcpy(ls->pc, &pcs, sizeof(pcs));
+    return !any(m8 & skip) || !any(m8 & ~skip);
+}
+
+/*
+ * True if every lane with instructions left is at the same pc with the same number left,
+ * which are returned through pc and remaining (0 when all lanes are done).
+ */
+static bool converged(Lockstep* ls, const uint32_t* budget, u8v* live, uint16_t* pc, uint32_t* remaining) {
+    int lead = -1;
+    *live = (u8v){ 0 };
+    *remaining = 0;
+    for (int lane = 0; lane < ls->count; lane++) {
+        if (!budget[lane])
+            continue;
+        (*live)[lane] = 0xFF;
+        if (lead < 0) {
+            lead = lane;
+            *pc = ls->pc[lane];
+            *remaining = budget[lane];
+        } else if (ls->pc[lane] != *pc || budget[lane] != *remaining) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Issues between checks of how much work vector code is doing. When most of a window went to the
+ * interpreter, the rest of the call runs each lane with VM_exec, which is cheaper than
+ * interpreting lane by lane in lockstep.
+ */
+#define WINDOW 64
+
+void Lockstep_exec(Lockstep* ls, uint32_t count) {
+    uint32_t budget[LOCKSTEP_LANES] = { 0 };  // instructions left per lane while diverged
+    uint32_t scalar[LOCKSTEP_LANES] = { 0 };  // instructions the interpreter ran, VM_tick counted those
+    u8v live;
+    uint16_t pc = 0;
+    uint32_t remaining;
+    uint32_t issues = 0;
+    uint32_t interpreted = 0;  // issues of the current window that went to the interpreter
+
+    for (int lane = 0; lane < ls->count; lane++) {
+        load_lane(ls, lane);
+        budget[lane] = count;
+    }
+
+    // While uniform all live lanes share pc and remaining and run as one
+    bool uniform = converged(ls, budget, &live, &pc, &remaining);
+    for (;;) {
+        u8v active = { 0 };
+        if (uniform) {
+            if (!remaining)
+                break;
+            active = live;
+        } else {
+            // Diverged: step the lanes at the lowest pc, the others wait for them there
+            pc = 0xFFFF;
+            for (int lane = 0; lane < ls->count; lane++) {
+                if (budget[lane] && ls->pc[lane] < pc)
+                    pc = ls->pc[lane];
+            }
+            if (pc == 0xFFFF)
+                break;
+            for (int lane = 0; lane < ls->count; lane++)
+                active[lane] = budget[lane] && ls->pc[lane] == pc ? 0xFF : 0;
+        }
+
+        int lead = 0;
+        while (!active[lead])
+            lead++;
+
+        if (ls->written[pc & ADDR_MASK] | ls->written[(pc + 1) & ADDR_MASK]) {
+            u8v same = same_code(ls, active, lead, pc);
+            if (any(same ^ active) && uniform) {
+                for (int lane = 0; lane < ls->count; lane++)
+                    budget[lane] = live[lane] ? remaining : 0;
+                uniform = false;
+            }
+            active = same;
+        }
+
+        Inst* inst = VM_decode_at(ls->vms[lead], pc);
+        bool together = issue(ls, inst, active, pc, lead, scalar);
+        ls->stats.issues++;
+        interpreted += !vectorized[inst->op];
+
+        if (uniform) {
+            remaining--;
+            pc = ls->pc[lead];
+            if (!together) {
+                for (int lane = 0; lane < ls->count; lane++)
+                    budget[lane] = live[lane] ? remaining : 0;
+                uniform = false;
+            }
+        } else {
+            for (int lane = 0; lane < ls->count; lane++)
+                budget[lane] -= active[lane] ? 1 : 0;
+            uniform = converged(ls, budget, &live, &pc, &remaining);
+        }
+
+        if (++issues % WINDOW == 0) {
+            if (interpreted > WINDOW / 2)
+                break;
+            interpreted = 0;
+        }
+    }
+
+    if (uniform) {
+        for (int lane = 0; lane < ls->count; lane++)
+            budget[lane] = live[lane] ? remaining : 0;
+    }
+
+    bool fallback = false;
+    for (int lane = 0; lane < ls->count; lane++) {
+        store_lane(ls, lane);
+        if (budget[lane]) {
+            VM_exec(ls->vms[lane], budget[lane]);
+            scalar[lane] += budget[lane];
+            fallback = true;
+        }
+        ls->vms[lane]->instructions += count - scalar[lane];
+        ls->stats.vector += count - scalar[lane];
+        ls->stats.scalar += scalar[lane];
+    }
+    if (fallback)
+        mark_differences(ls);
+}
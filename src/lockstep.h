@@ -0,0 +1,36 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdint.h>
+#include "vm.h"
+
+// One lane per byte of a vector register: 32 with AVX2 (SIMD=avx2 in the Makefile), 16 otherwise
+#if defined(__AVX2__)
+#define LOCKSTEP_LANES 32
+#else
+#define LOCKSTEP_LANES 16
+#endif
+
+/*
+ * Runs up to LOCKSTEP_LANES copies of a ROM side by side, with their V, I and PC registers
+ * laid out across instances. While copies are at the same pc, 6XNN, 7XNN, 8XYN, ANNN, FX1E, 1NNN
+ * and the register skips execute on every lane at once. Other instructions run through the
+ * interpreter one lane at a time. Lanes that diverge are stepped lowest pc first so they
+ * tend to meet again.
+ */
+typedef struct Lockstep Lockstep;
+
+typedef struct {
+    uint64_t issues;             // instructions issued to a group of lanes
+    uint64_t vector;             // lane instructions executed by vector code
+    uint64_t scalar;             // lane instructions left to the interpreter
+} LockstepStats;
+
+// The VMs stay owned by the caller and hold everything but V, I and PC between calls.
+Lockstep* Lockstep_init(VM** vms, int count);
+void Lockstep_free(Lockstep* lockstep);
+// Same contract as VM_exec for every VM: each runs exactly `count` instructions.
+void Lockstep_exec(Lockstep* lockstep, uint32_t count);
+LockstepStats Lockstep_stats(Lockstep* lockstep);
+
+#endif
@@ -1,24 +1,419 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "vm.h"
+#include "io.h"
+#include "run.h"
+#include "clock.h"
+#include "jit.h"
+#include "lockstep.h"
+#include "snapshot.h"
+#include "pipeline.h"
+#include "profile.h"
+#include "trace.h"
+#include "cycles.h"
+
+#define DEFAULT_SCALE 10
+#define DEFAULT_AUDIO_SAMPLES 512
+#define DEFAULT_REWIND_KB 1024
+#define TRACE_EVENTS (1 << 18)  // about 10 per frame, the last 7 minutes or so are kept
+
+static void jit_exec(void* jit, VM* vm, uint32_t count) {
+    JIT_exec(jit, count);
+}
+
+/*
+ * Runs `copies` headless copies of a ROM, each with its own random seed, as fast as possible and
+ * prints the combined instructions/sec. With lockstep they run in groups of LOCKSTEP_LANES,
+ * otherwise through one VM_exec per copy.
+ */
+static int run_copies(char* rom, int copies, const RunConfig* config, bool lockstep) {
+    VM** vms = calloc(copies, sizeof(VM*));
+    int groups = lockstep ? (copies + LOCKSTEP_LANES - 1) / LOCKSTEP_LANES : 0;
+    Lockstep** group = calloc(groups + 1, sizeof(Lockstep*));
+    uint64_t frames = config->frames ? config->frames : FRAME_RATE * 10;
+
+    for (int k = 0; k < copies; k++) {
+        vms[k] = VM_init();
+        if (VM_load_rom(vms[k], rom) == -1) {
+            printf("No such file \"%s\"\n", rom);
+            for (int j = 0; j <= k; j++)
+                VM_free(vms[j]);
+            free(group);
+            free(vms);
+            return 0;
+        }
+        VM_seed(vms[k], k + 1);
+    }
+    for (int g = 0; g < groups; g++) {
+        int lanes = copies - g * LOCKSTEP_LANES;
+        group[g] = Lockstep_init(vms + g * LOCKSTEP_LANES, lanes < LOCKSTEP_LANES ? lanes : LOCKSTEP_LANES);
+    }
+
+    uint64_t start = Clock_now_ns();
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        // Every copy ticks its timers each frame, so they all agree on the frame's batch
+        if (lockstep) {
+            for (int g = 0; g < groups; g++)
+                Lockstep_exec(group[g], VM_frame_instructions(vms[0], config->ips));
+        } else {
+            for (int k = 0; k < copies; k++)
+                VM_exec(vms[k], VM_frame_instructions(vms[k], config->ips));
+        }
+        for (int k = 0; k < copies; k++)
+            VM_tick_timers(vms[k]);
+    }
+    double elapsed = (double)(Clock_now_ns() - start) / NS_PER_SEC;
+
+    uint64_t instructions = 0;
+    for (int k = 0; k < copies; k++)
+        instructions += vms[k]->instructions;
+    printf("Executed %llu instructions across %d copies in %.3fs (%.0f instructions/sec)\n",
+        (unsigned long long)instructions, copies, elapsed, elapsed > 0 ? instructions / elapsed : 0);
+
+    if (lockstep) {
+        LockstepStats total = { 0 };
+        for (int g = 0; g < groups; g++) {
+            LockstepStats stats = Lockstep_stats(group[g]);
+            total.issues += stats.issues;
+            total.vector += stats.vector;
+            total.scalar += stats.scalar;
+        }
+        printf("Lockstep: %d lanes, %llu issues, %.1f%% of instructions vectorized\n", LOCKSTEP_LANES,
+            (unsigned long long)total.issues, instructions ? 100.0 * total.vector / instructions : 0);
+    }
+
+    for (int g = 0; g < groups; g++)
+        Lockstep_free(group[g]);
+    for (int k = 0; k < copies; k++)
+        VM_free(vms[k]);
+    free(group);
+    free(vms);
+    return 0;
+}
+
+static bool load_state(VM* vm, const char* fpath) {
+    uint8_t buffer[SNAPSHOT_SIZE + 1];
+    FILE* fd = fopen(fpath, "rb");
+    if (fd == NULL)
+        return false;
+    size_t size = fread(buffer, 1, sizeof(buffer), fd);
+    fclose(fd);
+    return VM_restore(vm, buffer, size);
+}
+
+static bool save_state(VM* vm, const char* fpath) {
+    uint8_t buffer[SNAPSHOT_SIZE];
+    FILE* fd = fopen(fpath, "wb");
+    if (fd == NULL)
+        return false;
+    VM_snapshot(vm, buffer);
+    bool written = fwrite(buffer, 1, sizeof(buffer), fd) == sizeof(buffer);
+    return fclose(fd) == 0 && written;
+}
+
+void usage() {
+    printf("Usage: chip8 [options] <rom>\n");
+    printf("  --null         run headless without a window or audio device\n");
+    printf("  --dump <file>  run headless and write the last frame to <file> as a PBM image\n");
+    printf("  --frames <n>   stop after n 60hz frames\n");
+    printf("  --ips <n>      instructions per second (default %d)\n", DEFAULT_IPS);
+    printf("  --turbo        run as fast as the host allows\n");
+    printf("  --vip-timing   charge instructions COSMAC VIP cycles against a budget per frame instead of\n");
+    printf("                 running --ips (runs the interpreter)\n");
+    printf("  --cycle-costs <file>  --vip-timing with costs from <file> over the VIP's, see src/cycles.h\n");
+    printf("  --scale <n>    initial window size in pixels per CHIP-8 pixel (default %d)\n", DEFAULT_SCALE);
+    printf("  --samples <n>  audio buffer size in samples, lower means less latency (default %d)\n", DEFAULT_AUDIO_SAMPLES);
+    printf("  --single-thread  emulate on the thread that presents instead of a thread of its own\n");
+    printf("  --jit          translate code to native x86-64 (falls back to the interpreter elsewhere)\n");
+    printf("  --rewind-kb <n>  memory for rewind history, hold backspace to rewind (default %d, 0 turns it off)\n", DEFAULT_REWIND_KB);
+    printf("  --load-state <file>  start from a save state instead of power-on\n");
+    printf("  --save-state <file>  write a save state on exit\n");
+    printf("  --seed <n>     seed for CXNN random numbers (default 0, a fixed seed)\n");
+    printf("  --record <file>  log the keys pressed, with the seed and speed, to <file>\n");
+    printf("  --replay <file>  replay an input log headless as fast as possible\n");
+    printf("  --profile <file>  count instructions per opcode and address and time each phase, written\n");
+    printf("                 as JSON to <file> on exit and on SIGUSR1 (runs the interpreter)\n");
+    printf("  --trace <file>  trace the timing of every frame and its phases, written on exit as Chrome\n");
+    printf("                 trace JSON (chrome://tracing, Perfetto) to <file>, with a frame time summary\n");
+    printf("  --run-ahead <n>  present the frame n frames ahead with the keys held now, hiding n frames of lag\n");
+    printf("  --shm <name>   publish frames to and take keys from shared memory <name>, see src/chip8_shm.h\n");
+    printf("  --copies <n>   benchmark n headless copies of the ROM with different random seeds\n");
+    printf("  --lockstep     run the copies in SIMD lockstep, %d per group\n", LOCKSTEP_LANES);
+}
 
 int main(int argc, char** argv) {
-    if (argc != 2) {
-        printf("Usage: chip8 <rom>\n");
+    char* rom = NULL;
+    char* dump_path = NULL;
+    char* load_path = NULL;
+    char* save_path = NULL;
+    char* record_path = NULL;
+    char* replay_path = NULL;
+    char* profile_path = NULL;
+    char* shm_name = NULL;
+    char* trace_path = NULL;
+    char* costs_path = NULL;
+    bool vip_timing = false;
+    CycleCosts costs = vip_costs;
+    uint32_t seed = 0;
+    InputLog log = { 0 };
+    bool headless = false;
+    bool use_jit = false;
+    bool single_thread = false;
+    bool lockstep = false;
+    int copies = 0;
+    int scale = DEFAULT_SCALE;
+    int audio_samples = DEFAULT_AUDIO_SAMPLES;
+    RunConfig config;
+    RunConfig_init(&config);
+    config.rewind_budget = DEFAULT_REWIND_KB * 1024;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--null") == 0) {
+            headless = true;
+        } else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            headless = true;
+            dump_path = argv[++i];
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            config.frames = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--ips") == 0 && i + 1 < argc) {
+            config.ips = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            scale = atoi(argv[++i]);
+            if (scale < 1)
+                scale = 1;
+        } else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+            audio_samples = atoi(argv[++i]);
+            if (audio_samples < 64)
+                audio_samples = 64;
+        } else if (strcmp(argv[i], "--turbo") == 0) {
+            config.turbo = true;
+        } else if (strcmp(argv[i], "--vip-timing") == 0) {
+            vip_timing = true;
+        } else if (strcmp(argv[i], "--cycle-costs") == 0 && i + 1 < argc) {
+            vip_timing = true;
+            costs_path = argv[++i];
+        } else if (strcmp(argv[i], "--single-thread") == 0) {
+            single_thread = true;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            use_jit = true;
+        } else if (strcmp(argv[i], "--rewind-kb") == 0 && i + 1 < argc) {
+            config.rewind_budget = strtoul(argv[++i], NULL, 10) * 1024;
+        } else if (strcmp(argv[i], "--load-state") == 0 && i + 1 < argc) {
+            load_path = argv[++i];
+        } else if (strcmp(argv[i], "--save-state") == 0 && i + 1 < argc) {
+            save_path = argv[++i];
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profile_path = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc) {
+            config.run_ahead = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+            shm_name = argv[++i];
+        } else if (strcmp(argv[i], "--copies") == 0 && i + 1 < argc) {
+            copies = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--lockstep") == 0) {
+            lockstep = true;
+        } else if (argv[i][0] != '-' && rom == NULL) {
+            rom = argv[i];
+        } else {
+            usage();
+            return 0;
+        }
+    }
+
+    if (rom == NULL) {
+        usage();
         return 0;
     }
+    if (costs_path && !CycleCosts_load(&costs, costs_path))
+        return 1;
+    if (copies > 0)
+        return run_copies(rom, copies, &config, lockstep);
+    if ((record_path || replay_path) && load_path) {
+        printf("--record and --replay start from power-on and can't be used with --load-state\n");
+        return 1;
+    }
+
+    // A replay runs headless as fast as possible, with the seed and speed of the recording
+    if (replay_path) {
+        if (!InputLog_load(&log, replay_path)) {
+            printf("Couldn't read an input log from \"%s\"\n", replay_path);
+            return 1;
+        }
+        seed = log.seed;
+        config.ips = log.ips;
+        // Recorded on a cycle budget, with the costs it was recorded with
+        if (log.ips == 0) {
+            vip_timing = true;
+            costs = log.costs;
+        }
+        config.frames = log.frames;
+        config.turbo = true;
+        config.replay = &log;
+        headless = true;
+    } else if (record_path) {
+        InputLog_init(&log, seed, vip_timing ? 0 : config.ips);
+        log.costs = costs;
+        config.record = &log;
+    }
+
+#ifdef CHIP8_HEADLESS
+    headless = true;
+#endif
 
     VM* vm = VM_init();
-    int16_t rom_size = VM_load_rom(vm, argv[1]);
+    int16_t rom_size = VM_load_rom(vm, rom);
 
     if (rom_size == -1) {
-        printf("No such file \"%s\"\n", argv[1]);
+        printf("No such file \"%s\"\n", rom);
         return 0;
     }
-    printf("Loaded %s (%d bytes)\n", argv[1], rom_size);
+    printf("Loaded %s (%d bytes)\n", rom, rom_size);
+    VM_seed(vm, seed);
+    if (load_path && !load_state(vm, load_path)) {
+        printf("Couldn't restore a save state from \"%s\"\n", load_path);
+        VM_free(vm);
+        return 1;
+    }
+
+    IO* io = NULL;
+    if (dump_path)
+        io = IO_init_dump(dump_path);
+    else if (headless)
+        io = IO_init_null();
+#ifndef CHIP8_HEADLESS
+    else
+        io = IO_init_sdl(scale, audio_samples);
+#endif
+    // Only the SDL front end has a rewind key, and going back in time would break an input log
+    if (headless || record_path || replay_path)
+        config.rewind_budget = 0;
+
+    if (io == NULL) {
+        VM_free(vm);
+        return 1;
+    }
+
+    if (shm_name) {
+        config.shm = Shm_open(shm_name);
+        if (config.shm == NULL) {
+            IO_free(io);
+            VM_free(vm);
+            return 1;
+        }
+    }
+
+    // Only the interpreter counts instructions
+    Profile* profile = NULL;
+    if (profile_path) {
+        profile = calloc(1, sizeof(Profile));
+        config.profile = profile;
+        config.profile_path = profile_path;
+        Profile_watch_signal();
+        if (use_jit) {
+            printf("--profile runs the interpreter, ignoring --jit\n");
+            use_jit = false;
+        }
+    }
+
+    if (trace_path)
+        config.trace = Trace_init(TRACE_EVENTS);
+    // Costs are charged per instruction, which only the interpreter does
+    if (vip_timing) {
+        config.cycles = &costs;
+        if (use_jit) {
+            printf("--vip-timing runs the interpreter, ignoring --jit\n");
+            use_jit = false;
+        }
+    }
+
+    JIT* jit = NULL;
+    if (use_jit) {
+        jit = JIT_init(vm);
+        if (jit) {
+            config.exec = jit_exec;
+            config.exec_data = jit;
+        } else {
+            printf("JIT not available on this host, using the interpreter\n");
+        }
+    }
+
+    uint64_t start = Clock_now_ns();
+    if (!headless && !single_thread)
+        VM_run_threaded(vm, io, &config);
+    else
+        VM_run(vm, io, &config);
+    double elapsed = (double)(Clock_now_ns() - start) / NS_PER_SEC;
+    printf("Executed %llu instructions in %.3fs (%.0f instructions/sec)\n",
+        (unsigned long long)vm->instructions, elapsed, elapsed > 0 ? vm->instructions / elapsed : 0);
+    int status = 0;
+    if (record_path) {
+        log.frames = vm->frames;
+        if (InputLog_save(&log, record_path)) {
+            printf("Recorded %llu frames and %zu input events to %s\n",
+                (unsigned long long)log.frames, log.count, record_path);
+        } else {
+            printf("Couldn't write the input log to \"%s\"\n", record_path);
+            status = 1;
+        }
+    }
+    if (record_path || replay_path)
+        printf("Framebuffer hash: %016llx\n", (unsigned long long)Display_hash(&vm->display));
+    if (profile) {
+        if (Profile_save(profile, profile_path)) {
+            printf("Wrote profile to %s\n", profile_path);
+        } else {
+            printf("Couldn't write the profile to \"%s\"\n", profile_path);
+            status = 1;
+        }
+        free(profile);
+    }
+    if (config.trace) {
+        Trace_summary(config.trace);
+        if (Trace_save(config.trace, trace_path)) {
+            printf("Wrote trace to %s\n", trace_path);
+        } else {
+            printf("Couldn't write the trace to \"%s\"\n", trace_path);
+            status = 1;
+        }
+        Trace_free(config.trace);
+    }
+    if (save_path && !save_state(vm, save_path)) {
+        printf("Couldn't write a save state to \"%s\"\n", save_path);
+        status = 1;
+    }
+    if (vm->halted) {
+        printf("Illegal instruction %02X%02X at 0x%03X\n", vm->memory[vm->pc & ADDR_MASK],
+            vm->memory[(vm->pc + 1) & ADDR_MASK], vm->pc & ADDR_MASK);
+        status = 1;
+    }
+    if (vm->cache.misses) {
+        printf("Decode cache: %llu hits, %llu misses, %llu invalidations\n",
+            (unsigned long long)vm->cache.hits,
+            (unsigned long long)vm->cache.misses, (unsigned long long)vm->cache.invalidations);
+    }
 
-    VM_run(vm);
+    if (jit) {
+        JITStats stats = JIT_stats(jit);
+        printf("JIT: %llu blocks, %llu chained exits, %llu flushes, %llu interpreted instructions\n",
+            (unsigned long long)stats.blocks, (unsigned long long)stats.chained,
+            (unsigned long long)stats.flushes, (unsigned long long)stats.interpreted);
+        JIT_free(jit);
+    }
+    if (config.shm)
+        Shm_close(config.shm);
+    IO_free(io);
     VM_free(vm);
+    InputLog_free(&log);
 
-    return 0;
+    return status;
 }
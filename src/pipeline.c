@@ -0,0 +1,242 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pipeline.h"
+#include "clock.h"
+
+#define QUEUE_SIZE 64            // power of two
+#define FRESH 4                  // set in TripleBuffer.middle while it holds a frame not yet read
+#define REWIND_BIT (1u << 16)    // in a KeyQueue entry, next to the 16 keys
+// How long the presenting thread sleeps between looks for a frame if the front end can't be woken
+#define POLL_NS NS_PER_MS
+#define WAIT_NS NS_PER_SEC
+
+/*
+ * The writer fills `back` and the reader shows `front`. Publishing swaps back with middle and
+ * reading swaps middle with front, each a single atomic exchange, so the reader only ever sees
+ * whole frames and neither side blocks. Frames the reader is too slow for are overwritten.
+ */
+typedef struct {
+    Display slots[3];
+    int back;    // writer only
+    int middle;  // slot index plus FRESH, accessed atomically
+    int front;   // reader only
+} TripleBuffer;
+
+// Key states, keys plus REWIND_BIT, from the presenting thread to the emulation thread
+typedef struct {
+    uint32_t entries[QUEUE_SIZE];
+    uint32_t head;  // next entry written, stored by the producer only
+    uint32_t tail;  // next entry read, stored by the consumer only
+} KeyQueue;
+
+typedef struct {
+    VM* vm;
+    const RunConfig* config;
+    IO* io;         // the real front end, used by the presenting thread only
+    IO proxy;       // what VM_run on the emulation thread talks to
+    TripleBuffer frames;
+    KeyQueue keys;
+    // Lets the emulation thread sleep while the VM waits for a key, see proxy_wait
+    pthread_mutex_t lock;
+    pthread_cond_t input;
+    // Accessed atomically
+    int tone;
+    int quit;       // the front end asked to quit
+    int done;       // VM_run returned
+} Pipeline;
+
+static void TripleBuffer_init(TripleBuffer* buffer) {
+    memset(buffer, 0, sizeof(TripleBuffer));
+    buffer->back = 0;
+    buffer->middle = 1;
+    buffer->front = 2;
+}
+
+static void TripleBuffer_publish(TripleBuffer* buffer, const Display* display) {
+    buffer->slots[buffer->back] = *display;
+    buffer->back = __atomic_exchange_n(&buffer->middle, buffer->back | FRESH, __ATOMIC_ACQ_REL) & 3;
+}
+
+// The newest published frame, NULL if there was none since the last call
+static const Display* TripleBuffer_read(TripleBuffer* buffer) {
+    if (!(__atomic_load_n(&buffer->middle, __ATOMIC_RELAXED) & FRESH))
+        return NULL;
+    buffer->front = __atomic_exchange_n(&buffer->middle, buffer->front, __ATOMIC_ACQ_REL) & 3;
+    return &buffer->slots[buffer->front];
+}
+
+static bool KeyQueue_push(KeyQueue* queue, uint32_t state) {
+    uint32_t head = queue->head;
+    if (head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) == QUEUE_SIZE)
+        return false;
+    queue->entries[head % QUEUE_SIZE] = state;
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Reads the oldest entry without taking it off the queue
+static bool KeyQueue_peek(KeyQueue* queue, uint32_t* state) {
+    uint32_t tail = queue->tail;
+    if (tail == __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE))
+        return false;
+    *state = queue->entries[tail % QUEUE_SIZE];
+    return true;
+}
+
+static void KeyQueue_pop(KeyQueue* queue) {
+    __atomic_store_n(&queue->tail, queue->tail + 1, __ATOMIC_RELEASE);
+}
+
+static bool KeyQueue_empty(KeyQueue* queue) {
+    return queue->tail == __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+}
+
+// Wakes the emulation thread if it's in proxy_wait
+static void signal_input(Pipeline* pipe) {
+    pthread_mutex_lock(&pipe->lock);
+    pthread_cond_signal(&pipe->input);
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+// The proxy front end, called by VM_run on the emulation thread
+
+static bool proxy_process_input(IO* io, Keyboard* keyboard) {
+    Pipeline* pipe = io->data;
+    uint32_t state;
+    uint16_t pressed = 0;
+    while (KeyQueue_peek(&pipe->keys, &state)) {
+        // A key pressed since the last frame is released on the next one, so the ROM sees every press
+        if (pressed & ~state)
+            break;
+        pressed |= state & ~keyboard->keys;
+        keyboard->keys = state;
+        io->rewind = state & REWIND_BIT;
+        KeyQueue_pop(&pipe->keys);
+    }
+    return !__atomic_load_n(&pipe->quit, __ATOMIC_ACQUIRE);
+}
+
+static void proxy_render(IO* io, const Display* display) {
+    Pipeline* pipe = io->data;
+    TripleBuffer_publish(&pipe->frames, display);
+    if (pipe->io->wake)
+        pipe->io->wake(pipe->io);
+}
+
+static void proxy_set_tone(IO* io, bool on) {
+    Pipeline* pipe = io->data;
+    __atomic_store_n(&pipe->tone, on, __ATOMIC_RELEASE);
+    if (pipe->io->wake)
+        pipe->io->wake(pipe->io);
+}
+
+static void proxy_wait(IO* io, uint64_t deadline) {
+    Pipeline* pipe = io->data;
+    uint64_t now = Clock_now_ns();
+    if (now >= deadline)
+        return;
+
+    // Condition variables time out on the wall clock
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    uint64_t ns = until.tv_nsec + (deadline - now);
+    until.tv_sec += ns / NS_PER_SEC;
+    until.tv_nsec = ns % NS_PER_SEC;
+
+    pthread_mutex_lock(&pipe->lock);
+    int status = 0;
+    while (status == 0 && KeyQueue_empty(&pipe->keys) && !__atomic_load_n(&pipe->quit, __ATOMIC_ACQUIRE))
+        status = pthread_cond_timedwait(&pipe->input, &pipe->lock, &until);
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+static void* emulate(void* data) {
+    Pipeline* pipe = data;
+    VM_run(pipe->vm, &pipe->proxy, pipe->config);
+    __atomic_store_n(&pipe->done, 1, __ATOMIC_RELEASE);
+    if (pipe->io->wake)
+        pipe->io->wake(pipe->io);
+    return NULL;
+}
+
+/*
+ * The presenting thread keeps its own copy of the frame on screen and marks the rows that differ
+ * from a new one as dirty itself, since rows changed in frames it skipped never reach it.
+ */
+static void present(IO* io, Display* shown, const Display* frame) {
+    if (frame) {
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            if (shown->rows[y] != frame->rows[y]) {
+                shown->rows[y] = frame->rows[y];
+                shown->dirty |= 1u << y;
+            }
+        }
+    }
+    // Also called without a new frame, for front ends to redraw after their window was exposed
+    io->render(io, shown);
+    shown->dirty = 0;
+}
+
+void VM_run_threaded(VM* vm, IO* io, const RunConfig* config) {
+    Pipeline* pipe = calloc(1, sizeof(Pipeline));
+    pipe->vm = vm;
+    pipe->config = config;
+    pipe->io = io;
+    pipe->proxy.data = pipe;
+    pipe->proxy.process_input = proxy_process_input;
+    pipe->proxy.render = proxy_render;
+    pipe->proxy.set_tone = proxy_set_tone;
+    pipe->proxy.wait = proxy_wait;
+    TripleBuffer_init(&pipe->frames);
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->input, NULL);
+
+    // Nothing of the VM is read here once the thread runs
+    Display shown = vm->display;
+    shown.dirty = DISPLAY_ALL_ROWS;
+    Keyboard keyboard = vm->keyboard;
+    uint32_t sent = keyboard.keys;
+    bool tone = false;
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, emulate, pipe);
+    while (!__atomic_load_n(&pipe->done, __ATOMIC_ACQUIRE)) {
+        if (!io->process_input(io, &keyboard)) {
+            __atomic_store_n(&pipe->quit, 1, __ATOMIC_RELEASE);
+            signal_input(pipe);
+            break;
+        }
+        // A full queue keeps the change for the next round
+        uint32_t state = keyboard.keys | (io->rewind ? REWIND_BIT : 0);
+        if (state != sent && KeyQueue_push(&pipe->keys, state)) {
+            sent = state;
+            signal_input(pipe);
+        }
+
+        bool on = __atomic_load_n(&pipe->tone, __ATOMIC_ACQUIRE);
+        if (on != tone) {
+            tone = on;
+            io->set_tone(io, tone);
+        }
+        present(io, &shown, TripleBuffer_read(&pipe->frames));
+
+        // Input, a new frame or the end of the run wake the front end up early
+        if (io->wait && io->wake)
+            io->wait(io, Clock_now_ns() + WAIT_NS);
+        else
+            Clock_sleep_until(Clock_now_ns() + POLL_NS);
+    }
+    pthread_join(thread, NULL);
+
+    // The frame the VM stopped on
+    present(io, &shown, TripleBuffer_read(&pipe->frames));
+    if (tone)
+        io->set_tone(io, false);
+
+    pthread_cond_destroy(&pipe->input);
+    pthread_mutex_destroy(&pipe->lock);
+    free(pipe);
+}
@@ -0,0 +1,15 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "run.h"
+
+/*
+ * Runs VM_run on a thread of its own while the calling thread, the one that created the front
+ * end, pumps its input and presents. Finished frames are handed over through a triple buffer
+ * and key changes come back through a single producer single consumer queue, so neither thread
+ * waits on the other: a slow present only means frames get skipped, never late instructions.
+ * Returns once the VM stops or the front end quits.
+ */
+void VM_run_threaded(VM* vm, IO* io, const RunConfig* config);
+
+#endif
@@ -0,0 +1,94 @@
+#define _POSIX_C_SOURCE 200809L
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+
+const char* const phase_names[PHASE_COUNT] = {
+    [PHASE_EXEC] = "exec", [PHASE_TIMERS] = "timers", [PHASE_AUDIO] = "audio", [PHASE_INPUT] = "input",
+    [PHASE_RENDER] = "render", [PHASE_SLEEP] = "sleep", [PHASE_RUN_AHEAD] = "run_ahead"
+};
+
+static volatile sig_atomic_t requested;
+
+typedef struct {
+    uint16_t pc;
+    uint64_t count;
+} HotPC;
+
+static int by_count(const void* a, const void* b) {
+    const HotPC* x = a;
+    const HotPC* y = b;
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    return x->pc - y->pc;
+}
+
+/*
+ * Layout: total instructions, counts by family ("0" to "F") and by Op name, DXYN counts, host
+ * time per VM_run phase in nanoseconds, and every address executed from, most executed first.
+ */
+bool Profile_save(const Profile* profile, const char* fpath) {
+    FILE* fd = fopen(fpath, "w");
+    if (fd == NULL)
+        return false;
+
+    uint64_t total = 0;
+    for (int op = 0; op < OP_COUNT; op++)
+        total += profile->ops[op];
+    fprintf(fd, "{\n  \"instructions\": %llu,\n", (unsigned long long)total);
+
+    fprintf(fd, "  \"families\": {");
+    for (int family = 0; family < 16; family++)
+        fprintf(fd, "%s\"%X\": %llu", family ? ", " : "", family,
+            (unsigned long long)profile->families[family]);
+    fprintf(fd, "},\n  \"ops\": {");
+    for (int op = 0; op < OP_COUNT; op++)
+        fprintf(fd, "%s\"%s\": %llu", op ? ", " : "", op_names[op], (unsigned long long)profile->ops[op]);
+
+    fprintf(fd, "},\n  \"draw\": {\"count\": %llu, \"collisions\": %llu, \"collision_rate\": %.4f},\n",
+        (unsigned long long)profile->draws, (unsigned long long)profile->collisions,
+        profile->draws ? (double)profile->collisions / profile->draws : 0.0);
+
+    fprintf(fd, "  \"phases_ns\": {");
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+        fprintf(fd, "%s\"%s\": %llu", phase ? ", " : "", phase_names[phase],
+            (unsigned long long)profile->phase_ns[phase]);
+
+    HotPC* hot = malloc(MEMORY_SIZE * sizeof(HotPC));
+    int count = 0;
+    for (int pc = 0; pc < MEMORY_SIZE; pc++) {
+        if (profile->pcs[pc])
+            hot[count++] = (HotPC){ pc, profile->pcs[pc] };
+    }
+    qsort(hot, count, sizeof(HotPC), by_count);
+    fprintf(fd, "},\n  \"hot_pcs\": [");
+    for (int h = 0; h < count; h++)
+        fprintf(fd, "%s\n    {\"pc\": \"0x%03X\", \"count\": %llu}", h ? "," : "", hot[h].pc,
+            (unsigned long long)hot[h].count);
+    fprintf(fd, "%s]\n}\n", count ? "\n  " : "");
+    free(hot);
+
+    return fclose(fd) == 0;
+}
+
+static void on_signal(int signal) {
+    requested = 1;
+}
+
+void Profile_watch_signal() {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+}
+
+bool Profile_requested() {
+    if (!requested)
+        return false;
+    requested = 0;
+    return true;
+}
@@ -0,0 +1,17 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include "vm.h"
+
+// JSON key of each Phase, also the names of its spans in a Trace
+extern const char* const phase_names[PHASE_COUNT];
+
+// Writes the counters of a Profile, see vm.h, as a JSON object. Returns false if the file can't be written.
+bool Profile_save(const Profile* profile, const char* fpath);
+// Makes SIGUSR1 request a dump, which VM_run writes at the end of the current frame
+void Profile_watch_signal();
+// True once per SIGUSR1 received since the last call
+bool Profile_requested();
+
+#endif
@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rewind.h"
+#include "snapshot.h"
+
+// Worst case encoding: every byte a literal, plus the two lengths around each run
+#define DELTA_MAX (SNAPSHOT_SIZE + SNAPSHOT_SIZE / 2 + 16)
+
+/*
+ * Entries are a 16-bit length, the delta and the length again, so the ring can be walked from
+ * both ends: the newest entry is popped from the head, the oldest dropped from the tail.
+ */
+struct Rewind {
+    uint8_t* ring;
+    size_t capacity;
+    size_t head;        // where the next entry is written
+    size_t used;
+    int depth;          // entries in the ring
+    bool recorded;      // newest holds a state
+    uint8_t newest[SNAPSHOT_SIZE];
+    uint8_t current[SNAPSHOT_SIZE];
+    uint8_t delta[DELTA_MAX];
+};
+
+Rewind* Rewind_init(size_t budget) {
+    Rewind* rewind = calloc(1, sizeof(Rewind));
+    rewind->capacity = budget;
+    rewind->ring = malloc(budget ? budget : 1);
+    return rewind;
+}
+
+void Rewind_free(Rewind* rewind) {
+    free(rewind->ring);
+    free(rewind);
+}
+
+int Rewind_depth(Rewind* rewind) {
+    return rewind->depth;
+}
+
+size_t Rewind_used(Rewind* rewind) {
+    return rewind->used;
+}
+
+static void ring_write(Rewind* rewind, size_t pos, const uint8_t* data, size_t size) {
+    pos %= rewind->capacity;
+    size_t first = size < rewind->capacity - pos ? size : rewind->capacity - pos;
+    memcpy(rewind->ring + pos, data, first);
+    memcpy(rewind->ring, data + first, size - first);
+}
+
+static void ring_read(Rewind* rewind, size_t pos, uint8_t* data, size_t size) {
+    pos %= rewind->capacity;
+    size_t first = size < rewind->capacity - pos ? size : rewind->capacity - pos;
+    memcpy(data, rewind->ring + pos, first);
+    memcpy(data + first, rewind->ring, size - first);
+}
+
+static uint16_t ring_length(Rewind* rewind, size_t pos) {
+    uint8_t bytes[2];
+    ring_read(rewind, pos, bytes, 2);
+    return bytes[0] | bytes[1] << 8;
+}
+
+static uint8_t* put_count(uint8_t* out, size_t count) {
+    while (count >= 0x80) {
+        *out++ = count | 0x80;
+        count >>= 7;
+    }
+    *out++ = count;
+    return out;
+}
+
+static size_t get_count(const uint8_t** in) {
+    size_t count = 0;
+    for (int shift = 0; ; shift += 7) {
+        uint8_t byte = *(*in)++;
+        count |= (size_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return count;
+    }
+}
+
+/*
+ * Encodes a XOR b as (zero bytes to skip, literal length, literal bytes) runs. Zeros after the
+ * last literal aren't encoded. Literals swallow zero gaps shorter than 3 bytes, which would cost
+ * more as a new run. Equal 8-byte words are skipped a word at a time.
+ */
+static size_t encode(const uint8_t* a, const uint8_t* b, uint8_t* out) {
+    uint8_t* start = out;
+    size_t pos = 0;
+    while (pos < SNAPSHOT_SIZE) {
+        size_t zeros = pos;
+        while (zeros + 8 <= SNAPSHOT_SIZE && memcmp(a + zeros, b + zeros, 8) == 0)
+            zeros += 8;
+        while (zeros < SNAPSHOT_SIZE && a[zeros] == b[zeros])
+            zeros++;
+        if (zeros == SNAPSHOT_SIZE)
+            break;
+
+        size_t end = zeros;
+        int gap = 0;
+        while (end < SNAPSHOT_SIZE && gap < 3) {
+            gap = a[end] == b[end] ? gap + 1 : 0;
+            end++;
+        }
+        end -= gap;
+
+        out = put_count(out, zeros - pos);
+        out = put_count(out, end - zeros);
+        for (size_t i = zeros; i < end; i++)
+            *out++ = a[i] ^ b[i];
+        pos = end;
+    }
+    return out - start;
+}
+
+// XORs an encoded delta back into state
+static void apply(uint8_t* state, const uint8_t* in, size_t size) {
+    const uint8_t* end = in + size;
+    size_t pos = 0;
+    while (in < end) {
+        pos += get_count(&in);
+        size_t literal = get_count(&in);
+        for (size_t i = 0; i < literal; i++)
+            state[pos++] ^= *in++;
+    }
+}
+
+static void drop_oldest(Rewind* rewind) {
+    size_t tail = rewind->head + rewind->capacity - rewind->used;
+    rewind->used -= ring_length(rewind, tail) + 4;
+    rewind->depth--;
+}
+
+void Rewind_push(Rewind* rewind, const VM* vm) {
+    VM_snapshot(vm, rewind->current);
+    if (!rewind->recorded) {
+        memcpy(rewind->newest, rewind->current, SNAPSHOT_SIZE);
+        rewind->recorded = true;
+        return;
+    }
+
+    size_t size = encode(rewind->newest, rewind->current, rewind->delta);
+    memcpy(rewind->newest, rewind->current, SNAPSHOT_SIZE);
+    if (size + 4 > rewind->capacity) {
+        // Can't keep even one step, the history starts over from here
+        rewind->used = 0;
+        rewind->depth = 0;
+        return;
+    }
+
+    while (rewind->capacity - rewind->used < size + 4)
+        drop_oldest(rewind);
+    uint8_t length[2] = { size & 0xFF, size >> 8 };
+    ring_write(rewind, rewind->head, length, 2);
+    ring_write(rewind, rewind->head + 2, rewind->delta, size);
+    ring_write(rewind, rewind->head + 2 + size, length, 2);
+    rewind->head = (rewind->head + size + 4) % rewind->capacity;
+    rewind->used += size + 4;
+    rewind->depth++;
+}
+
+bool Rewind_pop(Rewind* rewind, VM* vm) {
+    if (rewind->depth == 0)
+        return false;
+
+    size_t end = rewind->head + rewind->capacity;
+    size_t size = ring_length(rewind, end - 2);
+    ring_read(rewind, end - 2 - size, rewind->delta, size);
+    apply(rewind->newest, rewind->delta, size);
+    rewind->head = (end - size - 4) % rewind->capacity;
+    rewind->used -= size + 4;
+    rewind->depth--;
+
+    return VM_restore(vm, rewind->newest, SNAPSHOT_SIZE);
+}
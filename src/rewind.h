@@ -0,0 +1,28 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "vm.h"
+
+/*
+ * Rewind history: a ring buffer of save states, each stored as the run-length encoded XOR of
+ * itself and the next one. Only the newest state is kept whole, older ones are rebuilt from it
+ * one delta at a time. When the buffer is full the oldest deltas are dropped.
+ */
+typedef struct Rewind Rewind;
+
+// `budget` is the size of the ring buffer in bytes
+Rewind* Rewind_init(size_t budget);
+void Rewind_free(Rewind* rewind);
+// Records the VM's current state, e.g. once per frame
+void Rewind_push(Rewind* rewind, const VM* vm);
+// Restores the state recorded before the newest one and forgets the newest. False if there is none.
+bool Rewind_pop(Rewind* rewind, VM* vm);
+// Number of states Rewind_pop can still go back
+int Rewind_depth(Rewind* rewind);
+// Bytes of the ring buffer in use
+size_t Rewind_used(Rewind* rewind);
+
+#endif
@@ -0,0 +1,266 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "clock.h"
+#include "run.h"
+#include "rewind.h"
+#include "profile.h"
+#include "snapshot.h"
+
+// Longest the loop blocks for input while the VM waits for a key
+#define IDLE_WAIT_NS NS_PER_SEC
+// Frames run back to back to catch up after the host stalled, beyond that the time is dropped
+#define MAX_CATCHUP_FRAMES 6
+
+// When frame `due` counted from `epoch` starts. Exact, where adding 1/60s up in ns would drift.
+static uint64_t deadline(uint64_t epoch, uint64_t due) {
+    return epoch + due * NS_PER_SEC / FRAME_RATE;
+}
+
+static void run_batch(VM* vm, const RunConfig* config) {
+    if (config->cycles) {
+        VM_exec_frame(vm, config->cycles);
+        return;
+    }
+    uint32_t batch = VM_frame_instructions(vm, config->ips);
+    if (config->exec)
+        config->exec(config->exec_data, vm, batch);
+    else
+        VM_exec(vm, batch);
+}
+
+// Adds the time since `since` to a phase of the profile and trace and returns the time now, 0 without either
+static uint64_t lap(const RunConfig* config, Phase phase, uint64_t since) {
+    if (!config->profile && !config->trace)
+        return 0;
+    uint64_t now = Clock_now_ns();
+    if (config->profile)
+        config->profile->phase_ns[phase] += now - since;
+    if (config->trace)
+        Trace_span(config->trace, phase_names[phase], since, now);
+    return now;
+}
+
+/*
+ * Runs `frames` more frames on `ahead`, a copy of the VM with the keys held now, and marks the rows
+ * that differ from the frame presented before. The VM itself is left alone, so nothing needs
+ * rolling back. Always interpreted: an Executor is bound to the VM it was made for.
+ */
+static void run_ahead(VM* ahead, const VM* vm, const RunConfig* config, uint64_t* shown) {
+    VM_clone(ahead, vm);
+    for (int frame = 0; frame < config->run_ahead && !ahead->halted; frame++) {
+        if (config->cycles)
+            VM_exec_frame(ahead, config->cycles);
+        else
+            VM_exec(ahead, VM_frame_instructions(ahead, config->ips));
+        VM_tick_timers(ahead);
+    }
+    ahead->display.dirty = vm->display.dirty;
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        if (ahead->display.rows[y] != shown[y]) {
+            ahead->display.dirty |= 1u << y;
+            shown[y] = ahead->display.rows[y];
+        }
+    }
+}
+
+void RunConfig_init(RunConfig* config) {
+    config->frames = 0;
+    config->ips = DEFAULT_IPS;
+    config->cycles = NULL;
+    config->turbo = false;
+    config->exec = NULL;
+    config->exec_data = NULL;
+    config->rewind_budget = 0;
+    config->record = NULL;
+    config->replay = NULL;
+    config->profile = NULL;
+    config->profile_path = NULL;
+    config->shm = NULL;
+    config->run_ahead = 0;
+    config->trace = NULL;
+}
+
+/*
+ * Runs the VM one 60hz frame at a time: input, a batch of instructions, then the timers and
+ * presentation. Front ends can skip presenting frames where display.dirty is 0. Unless running
+ * in turbo mode the loop then sleeps until the next frame is due. Stops after the frame where the
+ * VM halted.
+ *
+ * A frame's batch depends only on the VM, ips / 60 instructions or a cycle budget, never on the
+ * host, so N frames always run the same instructions. Deadlines are exact multiples of 1/60s from
+ * when the loop started: frames that start late are caught up by sleeping less, and after a stall
+ * of more than MAX_CATCHUP_FRAMES the schedule restarts rather than fast-forwarding through it.
+ *
+ * While the VM waits for a key, front ends with a wait function block the loop until input
+ * arrives rather than running empty frames 60 times a second, unless frames go to shared memory.
+ *
+ * With a rewind budget the state is recorded after every frame, and frames where the front end
+ * reports the rewind key held step back one recorded frame instead of running.
+ *
+ * With a shared memory segment every presented frame is published to it, and the keys held
+ * through it are or'ed with the front end's.
+ *
+ * With run-ahead the frame presented is the one `run_ahead` frames later with the keys held now,
+ * emulated on a copy of the VM, which hides that many frames of a ROM's reaction to input. The
+ * sound, rewind history, input log and shared memory still follow the VM itself.
+ *
+ * With a profile the VM counts every instruction, and the loop times its phases. A dump requested
+ * by SIGUSR1 is written to profile_path at the end of the frame. A trace gets the same phases as
+ * spans, plus one span per frame and, unless in turbo mode, how late each frame started.
+ */
+void VM_run(VM* vm, IO* io, const RunConfig* config) {
+    uint64_t epoch = Clock_now_ns();
+    uint64_t due = 0;  // frames scheduled since epoch
+    uint64_t next_frame = epoch;
+    bool tone = false;
+    Rewind* rewind = NULL;
+    Profile* profile = config->profile;
+    Trace* trace = config->trace;
+    uint64_t frame_start = 0;
+    Keyboard input = vm->keyboard;  // the front end's keys, without the ones held through shm
+    VM* ahead = NULL;
+    uint64_t shown[SCREEN_HEIGHT];
+    uint64_t ahead_frames = 0;
+    uint64_t ahead_ns = 0;
+    uint64_t ahead_max_ns = 0;
+    if (config->run_ahead > 0) {
+        ahead = VM_init();
+        memcpy(shown, vm->display.rows, sizeof(shown));
+    }
+    vm->profile = profile;
+    if (config->rewind_budget) {
+        rewind = Rewind_init(config->rewind_budget);
+        Rewind_push(rewind, vm);
+    }
+
+    for (uint64_t frame = 0; !config->frames || frame < config->frames; frame++) {
+        uint64_t mark = profile || trace ? Clock_now_ns() : 0;
+        if (trace) {
+            if (frame_start)
+                Trace_span(trace, "frame", frame_start, mark);
+            // How long after its deadline the frame started, which sleeping can only make later
+            if (!config->turbo)
+                Trace_counter(trace, "lateness_ns", mark, (int64_t)(mark - next_frame));
+            frame_start = mark;
+        }
+        // Input is read right before the batch, so a key pressed while the loop slept is seen by
+        // the instructions of this frame and its answer presented at the end of it
+        if (config->shm) {
+            // Kept apart so keys released through the segment don't stay held
+            if (!io->process_input(io, &input))
+                break;
+            vm->keyboard.keys = input.keys | Shm_keys(config->shm);
+        } else if (!io->process_input(io, &vm->keyboard)) {
+            break;
+        }
+        if (config->replay)
+            vm->keyboard.keys = InputLog_replay(config->replay, vm->instructions, vm->keyboard.keys);
+        if (config->record)
+            InputLog_record(config->record, vm->instructions, vm->keyboard.keys);
+        mark = lap(config, PHASE_INPUT, mark);
+
+        bool rewinding = rewind && io->rewind;
+        if (rewinding) {
+            // The keys held now matter, not the ones held back then
+            uint16_t keys = vm->keyboard.keys;
+            Rewind_pop(rewind, vm);
+            vm->keyboard.keys = keys;
+        } else {
+            run_batch(vm, config);
+        }
+        mark = lap(config, PHASE_EXEC, mark);
+
+        if ((vm->sound > 0) != tone) {
+            tone = !tone;
+            io->set_tone(io, tone);
+            // Samples are synthesized in the audio callback, nothing is queued but the tone state
+            if (trace)
+                Trace_counter(trace, "tone", Clock_now_ns(), tone);
+        }
+        mark = lap(config, PHASE_AUDIO, mark);
+        if (!rewinding) {
+            VM_tick_timers(vm);
+            if (rewind)
+                Rewind_push(rewind, vm);
+        }
+        mark = lap(config, PHASE_TIMERS, mark);
+
+        if (ahead) {
+            uint64_t start = Clock_now_ns();
+            run_ahead(ahead, vm, config, shown);
+            uint64_t elapsed = Clock_now_ns() - start;
+            ahead_frames++;
+            ahead_ns += elapsed;
+            if (elapsed > ahead_max_ns)
+                ahead_max_ns = elapsed;
+            mark = lap(config, PHASE_RUN_AHEAD, mark);
+            io->render(io, &ahead->display);
+        } else {
+            io->render(io, &vm->display);
+        }
+        vm->display.dirty = 0;
+        if (config->shm)
+            Shm_publish(config->shm, vm);
+        mark = lap(config, PHASE_RENDER, mark);
+
+        if (profile && config->profile_path && Profile_requested()) {
+            if (Profile_save(profile, config->profile_path))
+                printf("Wrote profile to %s\n", config->profile_path);
+            mark = Clock_now_ns();
+        }
+
+        if (vm->halted)
+            break;
+
+        if (!config->turbo) {
+            next_frame = deadline(epoch, ++due);
+            // Keys held through shared memory can't wake the front end, and its readers expect a
+            // frame every 1/60s, so a segment keeps the loop running every frame
+            if (io->wait && !tone && !config->shm && VM_waiting_for_key(vm)) {
+                // Only a key can change anything, so block until input arrives instead of waking up
+                // every frame. The frames whose deadlines passed meanwhile then run back to back
+                // with the keys held before, as they would have without the wait since they were
+                // due before the key came. Input is read again at the start of the next frame, the
+                // first one due after the key, which presents the result. The frames run here
+                // aren't presented and count as a single exec phase.
+                io->wait(io, next_frame + IDLE_WAIT_NS);
+                mark = lap(config, PHASE_SLEEP, mark);
+                while (deadline(epoch, due + 1) <= Clock_now_ns() &&
+                    (!config->frames || frame + 1 < config->frames)) {
+                    run_batch(vm, config);
+                    VM_tick_timers(vm);
+                    if (rewind)
+                        Rewind_push(rewind, vm);
+                    frame++;
+                    next_frame = deadline(epoch, ++due);
+                }
+                mark = lap(config, PHASE_EXEC, mark);
+            }
+            uint64_t now = Clock_now_ns();
+            if (now > deadline(epoch, due + MAX_CATCHUP_FRAMES)) {
+                // The host stalled, e.g. suspended or stopped in a debugger
+                epoch = next_frame = now;
+                due = 0;
+            }
+            Clock_sleep_until(next_frame);
+            lap(config, PHASE_SLEEP, mark);
+        }
+    }
+
+    if (tone)
+        io->set_tone(io, false);
+    if (rewind)
+        Rewind_free(rewind);
+    if (ahead) {
+        if (ahead_frames) {
+            printf("Run-ahead of %d frames: %.1fus average, %.1fus max per frame (%.1f%% of the frame time)\n",
+                config->run_ahead, (double)ahead_ns / ahead_frames / NS_PER_US,
+                (double)ahead_max_ns / NS_PER_US,
+                100.0 * ahead_ns / ahead_frames / (NS_PER_SEC / FRAME_RATE));
+        }
+        VM_free(ahead);
+    }
+    vm->profile = NULL;
+}
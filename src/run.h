@@ -0,0 +1,38 @@
+#ifndef RUN_H
+#define RUN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "vm.h"
+#include "io.h"
+#include "input_log.h"
+#include "shm.h"
+#include "trace.h"
+
+#define DEFAULT_IPS 500
+
+// Runs exactly `count` instructions, e.g. VM_exec or a recompiler
+typedef void (*Executor)(void* data, VM* vm, uint32_t count);
+
+typedef struct {
+    uint64_t frames;  // stop after this many 60hz frames, 0 runs until the front end quits
+    uint32_t ips;     // instructions per emulated second, run in batches of ips / 60 per frame
+    const CycleCosts* cycles;  // runs frames on a cycle budget instead of ips, see VM_exec_frame
+    bool turbo;       // don't wait for wall-clock time between frames
+    Executor exec;    // NULL runs the interpreter
+    void* exec_data;
+    size_t rewind_budget;  // bytes of rewind history recorded every frame, 0 turns rewind off
+    InputLog* record;      // logs every change of the keys held
+    InputLog* replay;      // overrides the front end's keys with the ones logged
+    Profile* profile;      // counts instructions and times each phase, see vm.h
+    const char* profile_path;  // where the profile is written on SIGUSR1, see Profile_watch_signal
+    Shm* shm;              // gets every presented frame, and adds the keys held through it
+    int run_ahead;         // frames emulated ahead of the one presented, 0 turns run-ahead off
+    Trace* trace;          // gets a span for every phase and frame, and the lateness of each frame
+} RunConfig;
+
+void RunConfig_init(RunConfig* config);
+void VM_run(VM* vm, IO* io, const RunConfig* config);
+
+#endif
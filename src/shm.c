@@ -0,0 +1,86 @@
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "shm.h"
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+struct Shm {
+    char* name;
+    Chip8Shm* segment;
+};
+
+Shm* Shm_open(const char* name) {
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+    if (fd < 0) {
+        printf("Couldn't create shared memory \"%s\": %s\n", name, strerror(errno));
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(Chip8Shm)) != 0) {
+        printf("Couldn't size shared memory \"%s\": %s\n", name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    void* map = mmap(NULL, sizeof(Chip8Shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Couldn't map shared memory \"%s\": %s\n", name, strerror(errno));
+        shm_unlink(name);
+        return NULL;
+    }
+
+    Shm* shm = calloc(1, sizeof(Shm));
+    shm->name = strdup(name);
+    shm->segment = map;
+    memset(shm->segment, 0, sizeof(Chip8Shm));
+    shm->segment->version = CHIP8_SHM_VERSION;
+    shm->segment->size = sizeof(Chip8Shm);
+    __atomic_store_n(&shm->segment->magic, CHIP8_SHM_MAGIC, __ATOMIC_RELEASE);
+    return shm;
+}
+
+void Shm_close(Shm* shm) {
+    munmap(shm->segment, sizeof(Chip8Shm));
+    shm_unlink(shm->name);
+    free(shm->name);
+    free(shm);
+}
+
+void Shm_publish(Shm* shm, const VM* vm) {
+    Chip8Shm* segment = shm->segment;
+    uint32_t seq = segment->seq;  // nobody else writes it
+
+    // Readers must see the odd sequence before any field changes
+    __atomic_store_n(&segment->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    segment->frame = vm->frames;
+    segment->instructions = vm->instructions;
+    segment->keys = vm->keyboard.keys;
+    segment->delay = vm->delay;
+    segment->sound = vm->sound;
+    segment->halted = vm->halted;
+    memcpy(segment->rows, vm->display.rows, sizeof(segment->rows));
+    __atomic_store_n(&segment->seq, seq + 2, __ATOMIC_RELEASE);
+
+#if defined(__linux__)
+    // Orders the load of waiters after the store of seq. Paired with the reader's fence between
+    // incrementing waiters and checking seq, either it sees the new seq or we see it waiting.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&segment->waiters, __ATOMIC_RELAXED))
+        syscall(SYS_futex, &segment->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+uint16_t Shm_keys(Shm* shm) {
+    return __atomic_load_n(&shm->segment->input, __ATOMIC_ACQUIRE) & 0xFFFF;
+}
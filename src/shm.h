@@ -0,0 +1,20 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <stdint.h>
+#include "vm.h"
+#include "chip8_shm.h"
+
+// A shared memory segment laid out as in chip8_shm.h, owned by the emulator
+typedef struct Shm Shm;
+
+// Creates (or takes over) the segment `name`, e.g. "/chip8". Prints why and returns NULL if it can't.
+Shm* Shm_open(const char* name);
+// Unmaps the segment and unlinks its name
+void Shm_close(Shm* shm);
+// Writes the VM's framebuffer, timers, keys and counters as the next frame and wakes waiting readers
+void Shm_publish(Shm* shm, const VM* vm);
+// Keys other programs hold through the segment
+uint16_t Shm_keys(Shm* shm);
+
+#endif
@@ -0,0 +1,85 @@
+#include <stddef.h>
+#include <string.h>
+#include "snapshot.h"
+
+static const uint8_t magic[4] = { 'C', 'H', '8', 'S' };
+// By version, each one appended fields to the one before
+static const size_t sizes[SNAPSHOT_VERSION + 1] = {
+    [1] = SNAPSHOT_SIZE - 5, [2] = SNAPSHOT_SIZE - 4, [3] = SNAPSHOT_SIZE
+};
+
+static uint8_t* put(uint8_t* out, uint64_t value, int bytes) {
+    for (int b = 0; b < bytes; b++)
+        *out++ = value >> (b * 8);
+    return out;
+}
+
+static uint64_t get(const uint8_t** in, int bytes) {
+    uint64_t value = 0;
+    for (int b = 0; b < bytes; b++)
+        value |= (uint64_t)*(*in)++ << (b * 8);
+    return value;
+}
+
+void VM_snapshot(const VM* vm, uint8_t* buffer) {
+    uint8_t* out = buffer;
+    memcpy(out, magic, sizeof(magic));
+    out = put(out + sizeof(magic), SNAPSHOT_VERSION, 2);
+    memcpy(out, vm->memory, MEMORY_SIZE);
+    out += MEMORY_SIZE;
+    memcpy(out, vm->v, sizeof(vm->v));
+    out += sizeof(vm->v);
+    out = put(out, vm->i, 2);
+    out = put(out, vm->delay, 1);
+    out = put(out, vm->sound, 1);
+    out = put(out, vm->pc, 2);
+    out = put(out, vm->sp, 1);
+    for (int s = 0; s < STACK_SIZE; s++)
+        out = put(out, vm->stack[s], 2);
+    for (int y = 0; y < SCREEN_HEIGHT; y++)
+        out = put(out, vm->display.rows[y], 8);
+    out = put(out, vm->keyboard.keys, 2);
+    out = put(out, vm->instructions, 8);
+    out = put(out, vm->frames, 8);
+    out = put(out, vm->rng, 4);
+    out = put(out, vm->halted, 1);
+    out = put(out, vm->key_wait, 1);
+    put(out, vm->cycle_debt, 4);
+}
+
+bool VM_restore(VM* vm, const uint8_t* buffer, size_t size) {
+    const uint8_t* in = buffer + sizeof(magic);
+    if (size < sizeof(magic) + 2 || memcmp(buffer, magic, sizeof(magic)) != 0)
+        return false;
+    uint16_t version = get(&in, 2);
+    if (version < 1 || version > SNAPSHOT_VERSION || size != sizes[version])
+        return false;
+
+    VM_write_memory(vm, in);
+    in += MEMORY_SIZE;
+    memcpy(vm->v, in, sizeof(vm->v));
+    in += sizeof(vm->v);
+    vm->i = get(&in, 2);
+    vm->delay = get(&in, 1);
+    vm->sound = get(&in, 1);
+    vm->pc = get(&in, 2);
+    vm->sp = get(&in, 1);
+    for (int s = 0; s < STACK_SIZE; s++)
+        vm->stack[s] = get(&in, 2);
+    for (int y = 0; y < SCREEN_HEIGHT; y++)
+        vm->display.rows[y] = get(&in, 8);
+    vm->display.dirty = DISPLAY_ALL_ROWS;
+    vm->keyboard.keys = get(&in, 2);
+    vm->instructions = get(&in, 8);
+    vm->frames = get(&in, 8);
+    vm->rng = get(&in, 4);
+    vm->halted = get(&in, 1);
+    vm->key_wait = version > 1 ? get(&in, 1) : 0;
+    vm->cycle_debt = version > 2 ? get(&in, 4) : 0;
+    return true;
+}
+
+void VM_clone(VM* to, const VM* from) {
+    VM_write_memory(to, from->memory);
+    memcpy(to->v, from->v, offsetof(VM, cache) - offsetof(VM, v));
+}
@@ -0,0 +1,32 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "vm.h"
+
+#define SNAPSHOT_VERSION 3
+
+/*
+ * Save states: memory, registers, stack, timers, framebuffer, keypad, counters and the random
+ * number generator in a fixed little-endian layout behind a "CH8S" magic and a version number,
+ * so files can be moved between hosts and builds. The decode cache isn't saved.
+ */
+#define SNAPSHOT_SIZE (6 + MEMORY_SIZE + 16 + 2 + 1 + 1 + 2 + 1 + STACK_SIZE * 2 + \
+    SCREEN_HEIGHT * 8 + 2 + 8 + 8 + 4 + 1 + 1 + 4)
+
+// Writes SNAPSHOT_SIZE bytes to buffer
+void VM_snapshot(const VM* vm, uint8_t* buffer);
+/*
+ * Returns false, leaving the VM alone, if buffer isn't a snapshot of this size and version.
+ * Older versions are still read: version 2 lacks the cycle debt, version 1 the FX0A key too.
+ */
+bool VM_restore(VM* vm, const uint8_t* buffer, size_t size);
+/*
+ * Makes `to` a copy of `from`, e.g. to fork a search. Only memory bytes that differ are written,
+ * so the instructions `to` already decoded stay cached where the two agree.
+ */
+void VM_clone(VM* to, const VM* from);
+
+#endif
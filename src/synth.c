@@ -0,0 +1,28 @@
+#include <string.h>
+#include "synth.h"
+
+void Synth_init(Synth* synth, int sample_rate, int frequency, int16_t gain) {
+    for (int i = 0; i < SYNTH_TABLE_SIZE; i++)
+        synth->table[i] = i < SYNTH_TABLE_SIZE / 2 ? gain : -gain;
+    synth->phase = 0;
+    synth->step = (uint32_t)(((uint64_t)frequency << 32) / sample_rate);
+    synth->tone = 0;
+}
+
+void Synth_set_tone(Synth* synth, bool on) {
+    __atomic_store_n(&synth->tone, on, __ATOMIC_RELEASE);
+}
+
+void Synth_fill(Synth* synth, int16_t* samples, int count) {
+    if (!__atomic_load_n(&synth->tone, __ATOMIC_ACQUIRE)) {
+        memset(samples, 0, count * sizeof(int16_t));
+        return;
+    }
+
+    uint32_t phase = synth->phase;
+    for (int i = 0; i < count; i++) {
+        samples[i] = synth->table[phase >> 24];
+        phase += synth->step;
+    }
+    synth->phase = phase;
+}
@@ -0,0 +1,27 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SYNTH_TABLE_SIZE 256
+#define TONE_FREQUENCY 281  // the pitch of the original sin() based square wave at 44.1khz
+
+/*
+ * Square wave tone generator for an audio callback. The emulator thread only flips the tone on
+ * and off, the audio thread reads one period of the wave from a table with a fixed point phase.
+ */
+typedef struct {
+    int16_t table[SYNTH_TABLE_SIZE];
+    uint32_t phase;  // position in the table, the top 8 bits index it
+    uint32_t step;   // phase increment per sample
+    int tone;        // 1 while the sound timer is active, accessed atomically
+} Synth;
+
+void Synth_init(Synth* synth, int sample_rate, int frequency, int16_t gain);
+// Safe to call from any thread.
+void Synth_set_tone(Synth* synth, bool on);
+// Writes `count` samples, silence while the tone is off.
+void Synth_fill(Synth* synth, int16_t* samples, int count);
+
+#endif
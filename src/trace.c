@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+#include "clock.h"
+
+typedef enum { TRACE_SPAN, TRACE_COUNTER } TraceKind;
+
+typedef struct {
+    const char* name;
+    uint64_t time;
+    int64_t value;  // duration in ns for spans
+    TraceKind kind;
+} TraceEvent;
+
+struct Trace {
+    TraceEvent* events;
+    size_t capacity;
+    size_t recorded;  // events ever recorded, the newest is at (recorded - 1) % capacity
+    uint64_t start;   // time 0 of the saved trace
+};
+
+Trace* Trace_init(size_t capacity) {
+    Trace* trace = calloc(1, sizeof(Trace));
+    trace->events = calloc(capacity ? capacity : 1, sizeof(TraceEvent));
+    trace->capacity = capacity ? capacity : 1;
+    trace->start = Clock_now_ns();
+    return trace;
+}
+
+void Trace_free(Trace* trace) {
+    free(trace->events);
+    free(trace);
+}
+
+static void record(Trace* trace, TraceKind kind, const char* name, uint64_t time, int64_t value) {
+    TraceEvent* event = &trace->events[trace->recorded++ % trace->capacity];
+    event->name = name;
+    event->time = time;
+    event->value = value;
+    event->kind = kind;
+}
+
+void Trace_span(Trace* trace, const char* name, uint64_t start, uint64_t end) {
+    record(trace, TRACE_SPAN, name, start, end - start);
+}
+
+void Trace_counter(Trace* trace, const char* name, uint64_t time, int64_t value) {
+    record(trace, TRACE_COUNTER, name, time, value);
+}
+
+// The events still in the ring, oldest first
+static size_t oldest(Trace* trace) {
+    return trace->recorded > trace->capacity ? trace->recorded - trace->capacity : 0;
+}
+
+bool Trace_save(Trace* trace, const char* fpath) {
+    FILE* fd = fopen(fpath, "w");
+    if (fd == NULL)
+        return false;
+
+    fprintf(fd, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+    for (size_t e = oldest(trace); e < trace->recorded; e++) {
+        const TraceEvent* event = &trace->events[e % trace->capacity];
+        double time = (double)(int64_t)(event->time - trace->start) / NS_PER_US;
+        fprintf(fd, "%s\n", e > oldest(trace) ? "," : "");
+        if (event->kind == TRACE_SPAN) {
+            fprintf(fd, "{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": %.3f, \"dur\": %.3f}",
+                event->name, time, (double)event->value / NS_PER_US);
+        } else {
+            fprintf(fd, "{\"name\": \"%s\", \"ph\": \"C\", \"pid\": 1, \"tid\": 1, \"ts\": %.3f, "
+                "\"args\": {\"value\": %lld}}", event->name, time, (long long)event->value);
+        }
+    }
+    fprintf(fd, "\n]}\n");
+    return fclose(fd) == 0;
+}
+
+static int by_value(const void* a, const void* b) {
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void summarize(Trace* trace, TraceKind kind, const char* name, const char* label) {
+    int64_t* values = malloc((trace->recorded - oldest(trace) + 1) * sizeof(int64_t));
+    size_t count = 0;
+    for (size_t e = oldest(trace); e < trace->recorded; e++) {
+        const TraceEvent* event = &trace->events[e % trace->capacity];
+        if (event->kind == kind && strcmp(event->name, name) == 0)
+            values[count++] = event->value;
+    }
+    if (count) {
+        qsort(values, count, sizeof(int64_t), by_value);
+        printf("%s over the last %zu frames: %.3fms p50, %.3fms p99, %.3fms max\n", label, count,
+            (double)values[(count - 1) / 2] / NS_PER_MS, (double)values[(count - 1) * 99 / 100] / NS_PER_MS,
+            (double)values[count - 1] / NS_PER_MS);
+    }
+    free(values);
+}
+
+void Trace_summary(Trace* trace) {
+    summarize(trace, TRACE_SPAN, "frame", "Frame time");
+    summarize(trace, TRACE_COUNTER, "lateness_ns", "Frame start lateness");
+}
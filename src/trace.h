@@ -0,0 +1,25 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Timing trace: spans and counter samples stamped with Clock_now_ns(), kept in a ring buffer
+ * allocated up front so recording never allocates. Once full the oldest events are overwritten.
+ * Saved in the Chrome trace event format, which chrome://tracing and Perfetto open.
+ */
+typedef struct Trace Trace;
+
+// Room for `capacity` events
+Trace* Trace_init(size_t capacity);
+void Trace_free(Trace* trace);
+// `name` must outlive the trace, e.g. a string literal
+void Trace_span(Trace* trace, const char* name, uint64_t start, uint64_t end);
+void Trace_counter(Trace* trace, const char* name, uint64_t time, int64_t value);
+bool Trace_save(Trace* trace, const char* fpath);
+// Prints the median, 99th percentile and maximum of the "frame" spans and "lateness_ns" counters
+void Trace_summary(Trace* trace);
+
+#endif
@@ -1,15 +1,15 @@
-#include <unistd.h>
-#include <fcntl.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
-#include <time.h>
-#include <math.h>
-#include <SDL2/SDL.h>
-#include "io.h"
 #include "vm.h"
+#include "handlers.h"
+
+// Computed goto dispatch is the default where the compiler supports it, see the Makefile
+#if !defined(DISPATCH_SWITCH) && !defined(DISPATCH_TABLE) && !defined(DISPATCH_GOTO) && defined(__GNUC__)
+#define DISPATCH_GOTO
+#endif
 
 const uint8_t fonts[] = {
     0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
@@ -30,317 +30,504 @@ const uint8_t fonts[] = {
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-/*
- * Test if a system is little endian. If it's little endian then convert the value to big endian.
- */
-uint16_t as_big_endian(uint16_t n) {
-    uint16_t test = 1;
-    if (*(uint8_t*)&test == 1)
-        return n << 8 | n >> 8;
-    return n;
-}
-
-void debug_inst(int i, char* opcode, Inst inst) {
+void debug_inst(int i, const char* opcode, Inst inst) {
 #ifdef DEBUG
     printf("%04X: %s (%04X)\n", i, opcode, inst.opcode);
 #endif
 }
 
+const char* op_names[OP_COUNT] = {
+    [OP_CLS] = "CLS", [OP_RET] = "RET", [OP_JP] = "JP", [OP_CALL] = "CALL",
+    [OP_SE] = "SE", [OP_SNE] = "SNE", [OP_SVE] = "SVE", [OP_LD_V] = "LD_V", [OP_ADD] = "ADD",
+    [OP_MOV] = "MOV", [OP_OR] = "OR", [OP_AND] = "AND", [OP_XOR] = "XOR", [OP_ADD_V] = "ADD_V",
+    [OP_SUB] = "SUB", [OP_SHR] = "SHR", [OP_SUBN] = "SUBN", [OP_SHL] = "SHL", [OP_SVNE] = "SVNE",
+    [OP_LD_I] = "LD_I", [OP_JP_V0] = "JP_V0", [OP_RND] = "RND", [OP_DRW] = "DRW", [OP_SKP] = "SKP",
+    [OP_SKNP] = "SKNP", [OP_LD_VDT] = "LD_VDT", [OP_LD_K] = "LD_K", [OP_LD_DT] = "LD_DT",
+    [OP_LD_ST] = "LD_ST", [OP_ADD_I] = "ADD_I", [OP_LD_F] = "LD_F", [OP_BCD] = "BCD",
+    [OP_STORE] = "STORE", [OP_LOAD] = "LOAD", [OP_ILLEGAL] = "???"
+};
+
+// Approximate timings of the VIP's interpreter, skips and FX55/FX65 counted for an average case
+const CycleCosts vip_costs = {
+    .op = {
+        [OP_CLS] = 24, [OP_RET] = 10, [OP_JP] = 12, [OP_CALL] = 26, [OP_SE] = 10, [OP_SNE] = 10,
+        [OP_SVE] = 14, [OP_LD_V] = 6, [OP_ADD] = 10, [OP_MOV] = 44, [OP_OR] = 44, [OP_AND] = 44,
+        [OP_XOR] = 44, [OP_ADD_V] = 44, [OP_SUB] = 44, [OP_SHR] = 44, [OP_SUBN] = 44, [OP_SHL] = 44,
+        [OP_SVNE] = 14, [OP_LD_I] = 12, [OP_JP_V0] = 22, [OP_RND] = 36, [OP_DRW] = 22, [OP_SKP] = 14,
+        [OP_SKNP] = 14, [OP_LD_VDT] = 10, [OP_LD_K] = 10, [OP_LD_DT] = 10, [OP_LD_ST] = 10,
+        [OP_ADD_I] = 18, [OP_LD_F] = 20, [OP_BCD] = 200, [OP_STORE] = 130, [OP_LOAD] = 130
+    },
+    .fetch = 40,
+    .draw_row = 20,
+    .frame = 2600,
+    .vblank = true
+};
+
 // 0x00E0
 void clear_screen(Inst* inst, VM* vm) {
-    for (int i = 0; i < BUFFER_SIZE; i++) {
-        vm->io->display->buffer[i] = 0;
-    }
+    for (int y = 0; y < SCREEN_HEIGHT; y++)
+        vm->display.dirty |= (uint32_t)(vm->display.rows[y] != 0) << y;
+    memset(vm->display.rows, 0, sizeof(vm->display.rows));
 }
 
 // 0x00EE
 void subroutine_return(Inst* inst, VM* vm) {
-    uint16_t return_addr = ((uint16_t*)vm->memory)[MEMORY_SIZE - vm->sp];
-    vm->sp -= 2;
-    vm->pc = return_addr;
+    vm->sp -= 1;
+    vm->pc = vm->stack[vm->sp % STACK_SIZE];
 }
 
 // 0x1NNN
 void jump(Inst* inst, VM* vm) {
-    uint16_t addr = inst->opcode & 0x0FFF;
-    vm->pc = addr;
+    vm->pc = inst->nnn;
 }
 
 // 0x2NNN
 void subroutine_call(Inst* inst, VM* vm) {
-    uint16_t return_addr = vm->pc;
-    uint16_t jump_addr = inst->opcode & 0x0FFF;
-    vm->pc = jump_addr;
-    // Stack grows down from the top of memory. It stores 16bit addresses
-    vm->sp += 2;
-    ((uint16_t*)vm->memory)[MEMORY_SIZE - vm->sp] = return_addr;
+    vm->stack[vm->sp % STACK_SIZE] = vm->pc;
+    vm->sp += 1;
+    vm->pc = inst->nnn;
 }
 
 // 0x3XNN
 void skip_equal(Inst* inst, VM* vm) {
-    uint8_t v_register = (inst->opcode >> 8) & 0x0F;
-    uint8_t value = inst->opcode & 0x00FF;
-
-    if (vm->v[v_register] == value)
+    if (vm->v[inst->x] == inst->nn)
         vm->pc += 2;
 }
 
 // 0x4XNN
 void skip_not_equal(Inst* inst, VM* vm) {
-    uint8_t v_register = (inst->opcode >> 8) & 0x0F;
-    uint8_t value = inst->opcode & 0x00FF;
-
-    if (vm->v[v_register] != value)
+    if (vm->v[inst->x] != inst->nn)
         vm->pc += 2;
 }
 
 // 0x5XY0
 void skip_registers_equal(Inst* inst, VM* vm) {
-    uint8_t v_register_y = (inst->opcode >> 4) & 0x0F;
-    uint8_t v_register_x = (inst->opcode >> 8) & 0x0F;
-
-    if (vm->v[v_register_y] == vm->v[v_register_x])
+    if (vm->v[inst->y] == vm->v[inst->x])
         vm->pc += 2;
 }
 
 // 0x6XNN
 void load_v(Inst* inst, VM* vm) {
-    uint8_t v_register = (inst->opcode >> 8) & 0x0F;
-    uint8_t value = inst->opcode & 0x00FF;
-    vm->v[v_register] = value;
+    vm->v[inst->x] = inst->nn;
 }
 
 // 0x7XNN
 void add(Inst* inst, VM* vm) {
-    uint8_t v_register = (inst->opcode >> 8) & 0x0F;
-    uint8_t value = inst->opcode & 0x00FF;
-    vm->v[v_register] += value;
+    vm->v[inst->x] += inst->nn;
+}
+
+// 0x8XY0
+void math_load(Inst* inst, VM* vm) {
+    vm->v[inst->x] = vm->v[inst->y];
+}
+
+// 0x8XY1
+void math_or(Inst* inst, VM* vm) {
+    vm->v[inst->x] |= vm->v[inst->y];
+    vm->v[0x0F] = 0;
+}
+
+// 0x8XY2
+void math_and(Inst* inst, VM* vm) {
+    vm->v[inst->x] &= vm->v[inst->y];
+    vm->v[0x0F] = 0;
+}
+
+// 0x8XY3
+void math_xor(Inst* inst, VM* vm) {
+    vm->v[inst->x] ^= vm->v[inst->y];
+    vm->v[0x0F] = 0;
+}
+
+// 0x8XY4
+void math_add(Inst* inst, VM* vm) {
+    uint8_t v_f_value = vm->v[inst->x] + vm->v[inst->y] > 0xFF ? 1 : 0;
+    vm->v[inst->x] += vm->v[inst->y];
+    vm->v[0x0F] = v_f_value;
+}
+
+// 0x8XY5
+void math_sub(Inst* inst, VM* vm) {
+    uint8_t v_f_value = vm->v[inst->x] > vm->v[inst->y] ? 1 : 0;
+    vm->v[inst->x] -= vm->v[inst->y];
+    vm->v[0x0F] = v_f_value;
+}
+
+// 0x8XY6
+void math_shr(Inst* inst, VM* vm) {
+    uint8_t v_f_value = vm->v[inst->y] & 0x01;
+    vm->v[inst->x] = vm->v[inst->y] >> 1;
+    vm->v[0x0F] = v_f_value;
+}
+
+// 0x8XY7
+void math_subn(Inst* inst, VM* vm) {
+    uint8_t v_f_value = vm->v[inst->y] > vm->v[inst->x] ? 1 : 0;
+    vm->v[inst->x] = vm->v[inst->y] - vm->v[inst->x];
+    vm->v[0x0F] = v_f_value;
+}
+
+// 0x8XYE
+void math_shl(Inst* inst, VM* vm) {
+    uint8_t v_f_value = vm->v[inst->y] >> 7;
+    vm->v[inst->x] = vm->v[inst->y] << 1;
+    vm->v[0x0F] = v_f_value;
+}
+
+/*
+ * Any opcode without a handler, including 0x0NNN which only made sense on the COSMAC VIP.
+ * Halts the VM by leaving pc on the instruction, so whatever is executing keeps running it
+ * until its caller checks vm->halted.
+ */
+void illegal(Inst* inst, VM* vm) {
+    vm->halted = true;
+    vm->pc -= 2;
 }
 
 // 0x8XYN
 void math(Inst* inst, VM* vm) {
-    uint8_t operation = inst->opcode & 0x0F;
-    uint8_t v_register_y = (inst->opcode >> 4) & 0x0F;
-    uint8_t v_register_x = (inst->opcode >> 8) & 0x0F;
-    uint8_t v_f_value = 0;
-
-    switch (operation) {
-        case 0x00:
-            vm->v[v_register_x] = vm->v[v_register_y];
-            break;
-        case 0x01:
-            vm->v[v_register_x] |= vm->v[v_register_y];
-            vm->v[0x0F] = v_f_value;
-            break;
-        case 0x02:
-            vm->v[v_register_x] &= vm->v[v_register_y];
-            vm->v[0x0F] = v_f_value;
-            break;
-        case 0x03:
-            vm->v[v_register_x] ^= vm->v[v_register_y];
-            vm->v[0x0F] = v_f_value;
-            break;
-        case 0x04:
-            if (vm->v[v_register_x] + vm->v[v_register_y] > 0xFF)
-                v_f_value = 1;
-
-            vm->v[v_register_x] += vm->v[v_register_y];
-            vm->v[0x0F] = v_f_value;
-            break;
-        case 0x05:
-            v_f_value = vm->v[v_register_x] > vm->v[v_register_y] ? 1 : 0;
-            vm->v[v_register_x] -= vm->v[v_register_y];
-            vm->v[0xF] = v_f_value;
-            break;
-        case 0x06:
-            v_f_value = vm->v[v_register_y] & 0b00000001;
-            vm->v[v_register_x] = vm->v[v_register_y] >> 1;
-            vm->v[0x0F] = v_f_value;
-            break;
-        case 0x07:
-            v_f_value = vm->v[v_register_y] > vm->v[v_register_x] ? 1 : 0;
-            vm->v[v_register_x] = vm->v[v_register_y] - vm->v[v_register_x];
-            vm->v[0x0F] = v_f_value;
-            break;
-        case 0x0E:
-            v_f_value = vm->v[v_register_y] >> 7;
-            vm->v[v_register_x] = vm->v[v_register_y] << 1;
-            vm->v[0x0F] = v_f_value;
-            break;
-        default:
-            exit(1);
+    switch (inst->n) {
+        case 0x00: math_load(inst, vm); break;
+        case 0x01: math_or(inst, vm); break;
+        case 0x02: math_and(inst, vm); break;
+        case 0x03: math_xor(inst, vm); break;
+        case 0x04: math_add(inst, vm); break;
+        case 0x05: math_sub(inst, vm); break;
+        case 0x06: math_shr(inst, vm); break;
+        case 0x07: math_subn(inst, vm); break;
+        case 0x0E: math_shl(inst, vm); break;
+        default: illegal(inst, vm);
     }
 }
 
 // 0x9XY0
 void skip_registers_not_equal(Inst* inst, VM* vm) {
-    uint8_t v_register_y = (inst->opcode >> 4) & 0x0F;
-    uint8_t v_register_x = (inst->opcode >> 8) & 0x0F;
-
-    if (vm->v[v_register_y] != vm->v[v_register_x])
+    if (vm->v[inst->y] != vm->v[inst->x])
         vm->pc += 2;
 }
 
 // 0xANNN
 void load_i(Inst* inst, VM* vm) {
-    uint16_t value = inst->opcode & 0x0FFF;
-    vm->i = value;
+    vm->i = inst->nnn;
 }
 
 // 0xBNNN
 void jump_offset(Inst* inst, VM* vm) {
-    uint16_t addr = inst->opcode &0x0FFF;
-    vm->pc = addr + vm->v[0];
+    vm->pc = inst->nnn + vm->v[0];
 }
 
 // 0xCXNN
 void rnd(Inst* inst, VM* vm) {
-    uint8_t v_register_x = (inst->opcode >> 8) & 0x0F;
-    uint8_t value = inst->opcode & 0x00FF;
-    vm->v[v_register_x] = rand() & value;
+    uint32_t x = vm->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    vm->rng = x;
+    vm->v[inst->x] = (x >> 24) & inst->nn;
 }
 
 // 0xDXYN
 void draw(Inst* inst, VM* vm) {
-    uint8_t x = (inst->opcode >> 8) & 0x0F;
-    uint8_t y = (inst->opcode >> 4) & 0x0F;
-    uint8_t x_coord = vm->v[x] % 64;
-    uint8_t y_coord = vm->v[y] % 32;
-    uint8_t height = inst->opcode & 0x0F;
-    uint8_t sprite_row;
-    uint8_t new_pixel;
-    uint8_t current_pixel;
-    uint32_t offset;
+    uint8_t x_coord = vm->v[inst->x] % 64;
+    uint8_t y_coord = vm->v[inst->y] % 32;
+    uint8_t height = inst->n;
+    uint64_t collision = 0;
+
+    // Sprites are clipped at the bottom edge, and at the right edge by the shift
+    if (y_coord + height > SCREEN_HEIGHT)
+        height = SCREEN_HEIGHT - y_coord;
 
-    vm->v[0x0F] = 0;
     for (int i = 0; i < height; i++) {
-        sprite_row = vm->memory[vm->i + i];
+        uint64_t sprite_row = (uint64_t)vm->memory[(vm->i + i) & ADDR_MASK] << 56 >> x_coord;
+        collision |= vm->display.rows[y_coord + i] & sprite_row;
+        vm->display.rows[y_coord + i] ^= sprite_row;
+        vm->display.dirty |= (uint32_t)(sprite_row != 0) << (y_coord + i);
+    }
+    vm->v[0x0F] = collision != 0;
+}
 
-        if (y_coord + i >= SCREEN_HEIGHT)
-            break;
+// 0xEX9E
+void skip_key_pressed(Inst* inst, VM* vm) {
+    if (vm->v[inst->x] < 16 && vm->keyboard.keys >> vm->v[inst->x] & 1)
+        vm->pc += 2;
+}
 
-        for (int j = 0; j < 8; j++) {
-            if (x_coord + j >= SCREEN_WIDTH)
-                break;
+// 0xEXA1
+void skip_key_not_pressed(Inst* inst, VM* vm) {
+    if (vm->v[inst->x] >= 16 || !(vm->keyboard.keys >> vm->v[inst->x] & 1))
+        vm->pc += 2;
+}
+
+// 0xEX9E and 0xEXA1
+void skip_key(Inst* inst, VM* vm) {
+    switch(inst->nn) {
+        case 0x9E: skip_key_pressed(inst, vm); break;
+        case 0xA1: skip_key_not_pressed(inst, vm); break;
+        default: illegal(inst, vm);
+    }
+}
 
-            offset = ((y_coord + i) * SCREEN_WIDTH) + x_coord + j;
-            new_pixel = (sprite_row >> (7-j)) & 0b00000001;
-            current_pixel = vm->io->display->buffer[offset];
+// 0xFX07
+void load_delay(Inst* inst, VM* vm) {
+    vm->v[inst->x] = vm->delay;
+}
 
-            if (new_pixel && current_pixel)
-                vm->v[0x0F] = 1;
+// Index of the lowest held key, keys != 0
+static inline int lowest_key(uint16_t keys) {
+#if defined(__GNUC__)
+    return __builtin_ctz(keys);
+#else
+    int key = 0;
+    while (!(keys >> key & 1))
+        key++;
+    return key;
+#endif
+}
 
-            vm->io->display->buffer[offset] ^= new_pixel;
-        }
+// 0xFX0A, stores a key once pressed and released, as on the COSMAC VIP, the lowest if several
+void wait_key(Inst* inst, VM* vm) {
+    if (!vm->key_wait) {
+        if (vm->keyboard.keys)
+            vm->key_wait = lowest_key(vm->keyboard.keys) + 1;
+        vm->pc -= 2;
+    } else if (vm->keyboard.keys >> (vm->key_wait - 1) & 1) {
+        vm->pc -= 2;
+    } else {
+        vm->v[inst->x] = vm->key_wait - 1;
+        vm->key_wait = 0;
     }
 }
 
-// 0xEX9E and 0xEXA1
-void skip_key(Inst* inst, VM* vm) {
-    uint8_t v_register = (inst->opcode >> 8) & 0x0F;
-    uint8_t operation = inst->opcode & 0x00FF;
-
-    switch(operation) {
-        case 0x9E:
-            if (vm->io->keyboard->input_active && vm->v[v_register] == vm->io->keyboard->input)
-                vm->pc += 2;
-            break;
-        case 0xA1:
-            if (!vm->io->keyboard->input_active || vm->v[v_register] != vm->io->keyboard->input)
-                vm->pc += 2;
-            break;
-        default:
-            exit(1);
+// 0xFX15
+void set_delay(Inst* inst, VM* vm) {
+    vm->delay = vm->v[inst->x];
+}
+
+// 0xFX18
+void set_sound(Inst* inst, VM* vm) {
+    vm->sound = vm->v[inst->x];
+}
+
+// 0xFX1E
+void add_i(Inst* inst, VM* vm) {
+    vm->i += vm->v[inst->x];
+    if (vm->i & 0xF000)
+        vm->v[0x0F] = 1;
+}
+
+// 0xFX29
+void load_font(Inst* inst, VM* vm) {
+    // offset to the font character. each font sprite is 5 rows tall
+    vm->i = (vm->v[inst->x] & 0x0F) * 5;
+}
+
+// 0xFX33
+void store_bcd(Inst* inst, VM* vm) {
+    uint8_t value = vm->v[inst->x];
+    for (int i = 2; i >= 0; i--) {
+        VM_write(vm, vm->i + i, value % 10);
+        value /= 10;
+    }
+}
+
+// 0xFX55
+void store_registers(Inst* inst, VM* vm) {
+    for (int i=0; i <= inst->x; i++) {
+        VM_write(vm, vm->i, vm->v[i]);
+        vm->i++;
+    }
+}
+
+// 0xFX65
+void load_registers(Inst* inst, VM* vm) {
+    for (int i=0; i <= inst->x; i++) {
+        vm->v[i] = vm->memory[vm->i & ADDR_MASK];
+        vm->i++;
     }
 }
 
 // 0xFXNN
 void f_family(Inst* inst, VM* vm) {
-    uint8_t v_register_x = (inst->opcode >> 8) & 0x0F;
-    uint8_t operation = inst->opcode & 0x00FF;
-    uint8_t value;
-    uint8_t remainder;
-
-    switch(operation) {
-        case 0x07:
-            vm->v[v_register_x] = vm->delay;
-            break;
-        case 0x0A:
-            if (!vm->io->keyboard->input_active)
-                vm->pc -= 2;
-            else
-                vm->v[v_register_x] = vm->io->keyboard->input;
-            break;
-        case 0x15:
-            vm->delay = vm->v[v_register_x];
-            break;
-        case 0x18:
-            vm->sound = vm->v[v_register_x];
-            break;
-        case 0x1E:
-            vm->i += vm->v[v_register_x];
-            if (vm->i & 0xF000)
-                vm->v[0x0F] = 1;
-            break;
-        case 0x29:
-            // offset to the font character. each font sprite is 5 rows tall
-            vm->i = (vm->v[v_register_x] & 0x0F) * 5;
-            break;
-        case 0x33:
-            value = vm->v[v_register_x];
-            for (int i = 2; i >= 0; i--) {
-                remainder = value % 10;
-                value /= 10;
-                vm->memory[vm->i + i] = remainder;
-            }
-            break;
-        case 0x55:
-            for (int i=0; i <= v_register_x; i++) {
-                vm->memory[vm->i] = vm->v[i];
-                vm->i++;
-            }
-            break;
-        case 0x65:
-            for (int i=0; i <= v_register_x; i++) {
-                vm->v[i] = vm->memory[vm->i];
-                vm->i++;
-            }
-            break;
-        default:
-            exit(1);
+    switch(inst->nn) {
+        case 0x07: load_delay(inst, vm); break;
+        case 0x0A: wait_key(inst, vm); break;
+        case 0x15: set_delay(inst, vm); break;
+        case 0x18: set_sound(inst, vm); break;
+        case 0x1E: add_i(inst, vm); break;
+        case 0x29: load_font(inst, vm); break;
+        case 0x33: store_bcd(inst, vm); break;
+        case 0x55: store_registers(inst, vm); break;
+        case 0x65: load_registers(inst, vm); break;
+        default: illegal(inst, vm);
     }
 }
 
-VM* VM_init() {
-    VM* vm = calloc(1, sizeof(VM));
-    memcpy(vm->memory, fonts, 5 * 16);
-    vm->io = IO_init();
-    return vm;
+// Handlers indexed by Op, used by the table and computed goto engines
+Handler handlers[OP_COUNT] = {
+    [OP_CLS] = clear_screen, [OP_RET] = subroutine_return, [OP_JP] = jump,
+    [OP_CALL] = subroutine_call, [OP_SE] = skip_equal, [OP_SNE] = skip_not_equal,
+    [OP_SVE] = skip_registers_equal, [OP_LD_V] = load_v, [OP_ADD] = add, [OP_MOV] = math_load,
+    [OP_OR] = math_or, [OP_AND] = math_and, [OP_XOR] = math_xor, [OP_ADD_V] = math_add,
+    [OP_SUB] = math_sub, [OP_SHR] = math_shr, [OP_SUBN] = math_subn, [OP_SHL] = math_shl,
+    [OP_SVNE] = skip_registers_not_equal, [OP_LD_I] = load_i, [OP_JP_V0] = jump_offset,
+    [OP_RND] = rnd, [OP_DRW] = draw, [OP_SKP] = skip_key_pressed, [OP_SKNP] = skip_key_not_pressed,
+    [OP_LD_VDT] = load_delay, [OP_LD_K] = wait_key, [OP_LD_DT] = set_delay, [OP_LD_ST] = set_sound,
+    [OP_ADD_I] = add_i, [OP_LD_F] = load_font, [OP_BCD] = store_bcd, [OP_STORE] = store_registers,
+    [OP_LOAD] = load_registers, [OP_ILLEGAL] = illegal
+};
+
+#define REPEAT_4(x) x, x, x, x
+#define REPEAT_16(x) REPEAT_4(x), REPEAT_4(x), REPEAT_4(x), REPEAT_4(x)
+#define REPEAT_64(x) REPEAT_16(x), REPEAT_16(x), REPEAT_16(x), REPEAT_16(x)
+#define ROW(op) { REPEAT_64(op), REPEAT_64(op), REPEAT_64(op), REPEAT_64(op) }
+#define MATH_OPS \
+    OP_MOV, OP_OR, OP_AND, OP_XOR, OP_ADD_V, OP_SUB, OP_SHR, OP_SUBN, \
+    OP_ILLEGAL, OP_ILLEGAL, OP_ILLEGAL, OP_ILLEGAL, OP_ILLEGAL, OP_ILLEGAL, OP_SHL, OP_ILLEGAL
+#define MATH_OPS_4 MATH_OPS, MATH_OPS, MATH_OPS, MATH_OPS
+
+/*
+ * Two level decode table indexed by [family][low byte]. Every family is resolved by its low byte
+ * (0x00E0/0x00EE, 0x8XYN, 0xEXNN and 0xFXNN) so decoding is a single load with no branches.
+ */
+static const uint8_t op_table[16][256] = {
+    [0x0] = { [0xE0] = OP_CLS, [0xEE] = OP_RET },
+    [0x1] = ROW(OP_JP),
+    [0x2] = ROW(OP_CALL),
+    [0x3] = ROW(OP_SE),
+    [0x4] = ROW(OP_SNE),
+    [0x5] = ROW(OP_SVE),
+    [0x6] = ROW(OP_LD_V),
+    [0x7] = ROW(OP_ADD),
+    [0x8] = { MATH_OPS_4, MATH_OPS_4, MATH_OPS_4, MATH_OPS_4 },
+    [0x9] = ROW(OP_SVNE),
+    [0xA] = ROW(OP_LD_I),
+    [0xB] = ROW(OP_JP_V0),
+    [0xC] = ROW(OP_RND),
+    [0xD] = ROW(OP_DRW),
+    [0xE] = { [0x9E] = OP_SKP, [0xA1] = OP_SKNP },
+    [0xF] = {
+        [0x07] = OP_LD_VDT, [0x0A] = OP_LD_K, [0x15] = OP_LD_DT, [0x18] = OP_LD_ST, [0x1E] = OP_ADD_I,
+        [0x29] = OP_LD_F, [0x33] = OP_BCD, [0x55] = OP_STORE, [0x65] = OP_LOAD
+    }
+};
+
+#undef REPEAT_4
+#undef REPEAT_16
+#undef REPEAT_64
+#undef ROW
+#undef MATH_OPS
+#undef MATH_OPS_4
+
+static inline void decode_operands(Inst* inst, uint16_t opcode) {
+    inst->opcode = opcode;
+    inst->family = opcode >> 12;
+    inst->x = (opcode >> 8) & 0x0F;
+    inst->y = (opcode >> 4) & 0x0F;
+    inst->n = opcode & 0x0F;
+    inst->nn = opcode & 0xFF;
+    inst->nnn = opcode & 0x0FFF;
 }
 
-void VM_free(VM* vm) {
-    IO_free(vm->io);
-    free(vm);
+static inline void decode(Inst* inst, uint16_t opcode) {
+    decode_operands(inst, opcode);
+    inst->op = op_table[inst->family][inst->nn];
+    // 0x0NNN machine code routines other than CLS and RET
+    if (inst->family == 0 && inst->x != 0)
+        inst->op = OP_ILLEGAL;
 }
 
-int16_t VM_load_rom(VM* vm, char* fpath) {
-    FILE* fd = fopen(fpath, "r");
-    if (fd == NULL)
-        return -1;
+void VM_decode(Inst* inst, uint16_t opcode) {
+    decode(inst, opcode);
+}
 
-    uint16_t* data = calloc(MAX_PROGRAM_SIZE, 1); 
-    uint16_t size = fread(data, 1, MAX_PROGRAM_SIZE, fd);
+static inline uint16_t read_opcode(VM* vm, uint16_t addr) {
+    addr &= ADDR_MASK;
+    return vm->memory[addr] << 8 | vm->memory[(addr + 1) & ADDR_MASK];
+}
 
-    memcpy(vm->memory + PROGRAM_START_ADDR, data, size);
-    vm->pc = PROGRAM_START_ADDR;
-    fclose(fd);
-    return size;
+static inline uint16_t fetch(VM* vm) {
+    return read_opcode(vm, vm->pc);
 }
 
-void VM_tick(VM* vm) {
+/*
+ * Every store to memory after a ROM is loaded goes through here so the decode cache never
+ * holds a stale instruction. An instruction at addr - 1 also has a byte at addr.
+ */
+void VM_write(VM* vm, uint16_t addr, uint8_t value) {
+    addr &= ADDR_MASK;
+    vm->memory[addr] = value;
+
+    uint16_t prev = (addr - 1) & ADDR_MASK;
+    if (vm->cache.valid[addr] | vm->cache.valid[prev]) {
+        vm->cache.valid[addr] = 0;
+        vm->cache.valid[prev] = 0;
+        vm->cache.invalidations++;
+        if (prev < vm->cache.dirty_lo)
+            vm->cache.dirty_lo = prev;
+        if (addr > vm->cache.dirty_hi)
+            vm->cache.dirty_hi = addr;
+    }
+}
+
+// Replaces all of memory with `memory`, going through VM_write only for bytes that change
+void VM_write_memory(VM* vm, const uint8_t* memory) {
+    for (int block = 0; block < MEMORY_SIZE; block += 64) {
+        if (memcmp(vm->memory + block, memory + block, 64) == 0)
+            continue;
+        for (int addr = block; addr < block + 64; addr++) {
+            if (vm->memory[addr] != memory[addr])
+                VM_write(vm, addr, memory[addr]);
+        }
+    }
+}
+
+void VM_flush_cache(VM* vm) {
+    memset(vm->cache.valid, 0, sizeof(vm->cache.valid));
+}
+
+/*
+ * Returns the decoded instruction at addr, decoding it only the first time that address is used.
+ */
+static inline Inst* cached_decode(VM* vm, uint16_t addr) {
+    addr &= ADDR_MASK;
+    Inst* inst = &vm->cache.entries[addr];
+    if (!vm->cache.valid[addr]) {
+        decode(inst, read_opcode(vm, addr));
+        vm->cache.valid[addr] = 1;
+        vm->cache.misses++;
+    }
+    return inst;
+}
+
+Inst* VM_decode_at(VM* vm, uint16_t addr) {
+    return cached_decode(vm, addr);
+}
+
+#if defined(NO_DECODE_CACHE)
+
+static inline Inst* fetch_decoded(VM* vm, Inst* scratch) {
+    decode(scratch, fetch(vm));
+    return scratch;
+}
+
+#else
+
+static inline Inst* fetch_decoded(VM* vm, Inst* scratch) {
+    vm->cache.hits += vm->cache.valid[vm->pc & ADDR_MASK];
+    return cached_decode(vm, vm->pc);
+}
+
+#endif
+
+#if defined(DISPATCH_SWITCH)
+
+/*
+ * The original decoder: compare against the two fixed opcodes, switch on the family and let
+ * math, skip_key and f_family switch again on their sub-operation.
+ */
+static inline void step(VM* vm) {
     Inst inst;
-    inst.opcode = as_big_endian(*(uint16_t*)(vm->memory + vm->pc));
-    inst.family = inst.opcode >> 12;
+    decode_operands(&inst, fetch(vm));
     int i = vm->pc;
     vm->pc += 2;
 
@@ -354,103 +541,404 @@ void VM_tick(VM* vm) {
     else {
         switch (inst.family) {
             // only for host systems like COSMAC VIP
-            case 0x00:
-                debug_inst(i, "SYS", inst);
-                exit(1);
-                break;
-            case 0x01:
-                debug_inst(i, "JP", inst);
-                jump(&inst, vm);
-                break;
-            case 0x02:
-                debug_inst(i, "CALL", inst);
-                subroutine_call(&inst, vm);
-                break;
-            case 0x03:
-                debug_inst(i, "SE", inst);
-                skip_equal(&inst, vm);
-                break;
-            case 0x04:
-                debug_inst(i, "SNE", inst);
-                skip_not_equal(&inst, vm);
-                break;
-            case 0x05:
-                debug_inst(i, "SVE", inst);
-                skip_registers_equal(&inst, vm);
-                break;
-            case 0x06:
-                debug_inst(i, "LD_V", inst);
-                load_v(&inst, vm);
-                break;
-            case 0x07:
-                debug_inst(i, "ADD", inst);
-                add(&inst, vm);
-                break;
-            case 0x08:
-                debug_inst(i, "MATH", inst);
-                math(&inst, vm);
-                break;
-            case 0x09:
-                debug_inst(i, "SVNE", inst);
-                skip_registers_not_equal(&inst, vm);
-                break;
-            case 0x0A:
-                debug_inst(i, "LD_I", inst);
-                load_i(&inst, vm);
-                break;
-            case 0x0B:
-                debug_inst(i, "JP", inst);
-                jump_offset(&inst, vm);
-                break;
-            case 0x0C:
-                debug_inst(i, "RND", inst);
-                rnd(&inst, vm);
-                break;
-            case 0x0D:
-                debug_inst(i, "DRW", inst);
-                draw(&inst, vm);
-                break;
-            case 0x0E:
-                debug_inst(i, "SKP", inst);
-                skip_key(&inst, vm);
-                break;
-            case 0x0F:
-                debug_inst(i, "Ffamily", inst);
-                f_family(&inst, vm);
-                break;
-            default:
-                debug_inst(i, "???", inst);
-                exit(1);
+            case 0x00: debug_inst(i, "SYS", inst); illegal(&inst, vm); break;
+            case 0x01: debug_inst(i, "JP", inst); jump(&inst, vm); break;
+            case 0x02: debug_inst(i, "CALL", inst); subroutine_call(&inst, vm); break;
+            case 0x03: debug_inst(i, "SE", inst); skip_equal(&inst, vm); break;
+            case 0x04: debug_inst(i, "SNE", inst); skip_not_equal(&inst, vm); break;
+            case 0x05: debug_inst(i, "SVE", inst); skip_registers_equal(&inst, vm); break;
+            case 0x06: debug_inst(i, "LD_V", inst); load_v(&inst, vm); break;
+            case 0x07: debug_inst(i, "ADD", inst); add(&inst, vm); break;
+            case 0x08: debug_inst(i, "MATH", inst); math(&inst, vm); break;
+            case 0x09: debug_inst(i, "SVNE", inst); skip_registers_not_equal(&inst, vm); break;
+            case 0x0A: debug_inst(i, "LD_I", inst); load_i(&inst, vm); break;
+            case 0x0B: debug_inst(i, "JP", inst); jump_offset(&inst, vm); break;
+            case 0x0C: debug_inst(i, "RND", inst); rnd(&inst, vm); break;
+            case 0x0D: debug_inst(i, "DRW", inst); draw(&inst, vm); break;
+            case 0x0E: debug_inst(i, "SKP", inst); skip_key(&inst, vm); break;
+            case 0x0F: debug_inst(i, "Ffamily", inst); f_family(&inst, vm); break;
         }
     }
 }
 
-void VM_run(VM* vm) {
-    uint32_t ticks = SDL_GetTicks();
-    uint32_t next_draw = 0;
-    uint32_t next_instruction = 0;
-     
+#else
+
+/*
+ * Table dispatch: the instruction is decoded once into an Op and its operands (and cached
+ * per address) and the handler is called through the handlers table.
+ */
+static inline void step(VM* vm) {
+    Inst scratch;
+    Inst* inst = fetch_decoded(vm, &scratch);
+    debug_inst(vm->pc, op_names[inst->op], *inst);
+    vm->pc += 2;
+    handlers[inst->op](inst, vm);
+}
+
+#endif
 
-    for (;;) {
-        ticks = SDL_GetTicks();
-        if (SDL_TICKS_PASSED(ticks, next_instruction)) {
-            VM_tick(vm);
-            next_instruction = ticks + 2;  // 500 instructions per second
+/*
+ * VM_exec while profiling: one instruction at a time through the handlers table, counting
+ * each one. Idle loops aren't skipped, every instruction of the batch runs and is counted.
+ */
+#if defined(__GNUC__)
+__attribute__((noinline, cold))
+#endif
+static void profile_exec(VM* vm, uint32_t count) {
+    Profile* profile = vm->profile;
+    Inst scratch;
+    for (uint32_t n = 0; n < count; n++) {
+        Inst* inst = fetch_decoded(vm, &scratch);
+        uint8_t op = inst->op;
+        profile->pcs[vm->pc & ADDR_MASK]++;
+        profile->families[inst->family]++;
+        profile->ops[op]++;
+        vm->pc += 2;
+        handlers[op](inst, vm);
+        if (op == OP_DRW) {
+            profile->draws++;
+            profile->collisions += vm->v[0xF];
         }
+    }
+    vm->instructions += count;
+}
 
-        if (SDL_TICKS_PASSED(ticks, next_draw)) {
-            if (vm->delay > 0)
-                vm->delay -= 1;
-            if (vm->sound > 0) {
-                Audio_play(vm->io->audio);
-                vm->sound -= 1;
+/*
+ * Runs one 60hz frame's worth of instructions by their cost rather than a count: every instruction
+ * is charged its cycles until the frame's budget is spent. The one that crosses it still runs and
+ * the overrun comes off the next frame's budget, so over any number of frames the VM gets exactly
+ * costs->frame cycles each whatever the host does. Waiting at FX0A ends the frame, as does DXYN
+ * with costs->vblank. Instructions run one at a time through the handlers table.
+ */
+void VM_exec_frame(VM* vm, const CycleCosts* costs) {
+    Profile* profile = vm->profile;
+    Inst scratch;
+    uint64_t spent = vm->cycle_debt;
+    uint32_t count = 0;
+    while (spent < costs->frame && !vm->halted) {
+        Inst* inst = fetch_decoded(vm, &scratch);
+        uint8_t op = inst->op;
+        uint16_t next = vm->pc + 2;
+        if (profile) {
+            profile->pcs[vm->pc & ADDR_MASK]++;
+            profile->families[inst->family]++;
+            profile->ops[op]++;
+        }
+        vm->pc = next;
+        handlers[op](inst, vm);
+        count++;
+        uint32_t cost = costs->fetch + costs->op[op];
+        if (op == OP_DRW) {
+            cost += costs->draw_row * inst->n;
+            // The sprite is drawn once the next frame starts, so that frame pays for it
+            if (costs->vblank && spent < costs->frame)
+                spent = costs->frame;
+            if (profile) {
+                profile->draws++;
+                profile->collisions += vm->v[0xF];
             }
+        } else if (op == OP_LD_K && vm->pc != next && spent < costs->frame) {
+            spent = costs->frame;
+        }
+        spent += cost;
+    }
+    vm->cycle_debt = spent > costs->frame ? spent - costs->frame : 0;
+    vm->instructions += count;
+}
+
+void VM_tick(VM* vm) {
+    step(vm);
+    vm->instructions++;
+}
+
+#if defined(DISPATCH_GOTO)
+
+/*
+ * Machine state at a backward jump, to spot loops that only wait for the delay timer or the keys.
+ * Neither changes in the middle of a batch, so a loop that is back in the same state without
+ * having stored, drawn or cleared anything will go round exactly the same way until the batch
+ * ends.
+ */
+typedef struct {
+    uint16_t pc;    // the jump target, MEMORY_SIZE when nothing is recorded
+    uint32_t at;    // instructions into the batch
+    uint8_t v[16];
+    uint16_t i;
+    uint8_t sp;
+    uint8_t delay;
+    uint8_t sound;
+    uint32_t rng;
+    uint16_t stack[STACK_SIZE];
+} LoopState;
+
+/*
+ * Called after a backward jump closing a loop that polled and had no other side effects. Returns
+ * how many of the `left` instructions of the batch are whole trips around the loop, which can be
+ * skipped without changing where the VM ends up.
+ */
+static uint32_t idle_trips(VM* vm, LoopState* seen, uint32_t n, uint32_t left) {
+    if (seen->pc == vm->pc && seen->i == vm->i && seen->sp == vm->sp && seen->rng == vm->rng &&
+        seen->delay == vm->delay && seen->sound == vm->sound &&
+        memcmp(seen->v, vm->v, sizeof(seen->v)) == 0 &&
+        memcmp(seen->stack, vm->stack, sizeof(seen->stack)) == 0) {
+        uint32_t period = n - seen->at;
+        return left / period * period;
+    }
+
+    seen->pc = vm->pc;
+    seen->at = n;
+    memcpy(seen->v, vm->v, sizeof(seen->v));
+    seen->i = vm->i;
+    seen->sp = vm->sp;
+    seen->delay = vm->delay;
+    seen->sound = vm->sound;
+    seen->rng = vm->rng;
+    memcpy(seen->stack, vm->stack, sizeof(seen->stack));
+    return 0;
+}
+
+/*
+ * Threaded dispatch using GCC's labels as values. Each handler ends with its own indirect jump
+ * to the next one, which gives the branch predictor one history per handler instead of a
+ * single shared dispatch branch.
+ */
+void VM_exec(VM* vm, uint32_t count) {
+    static void* labels[OP_COUNT] = {
+        [OP_CLS] = &&op_cls, [OP_RET] = &&op_ret, [OP_JP] = &&op_jp,
+        [OP_CALL] = &&op_call, [OP_SE] = &&op_se, [OP_SNE] = &&op_sne, [OP_SVE] = &&op_sve,
+        [OP_LD_V] = &&op_ld_v, [OP_ADD] = &&op_add, [OP_MOV] = &&op_mov, [OP_OR] = &&op_or,
+        [OP_AND] = &&op_and, [OP_XOR] = &&op_xor, [OP_ADD_V] = &&op_add_v, [OP_SUB] = &&op_sub,
+        [OP_SHR] = &&op_shr, [OP_SUBN] = &&op_subn, [OP_SHL] = &&op_shl, [OP_SVNE] = &&op_svne,
+        [OP_LD_I] = &&op_ld_i, [OP_JP_V0] = &&op_jp_v0, [OP_RND] = &&op_rnd, [OP_DRW] = &&op_drw,
+        [OP_SKP] = &&op_skp, [OP_SKNP] = &&op_sknp, [OP_LD_VDT] = &&op_ld_vdt, [OP_LD_K] = &&op_ld_k,
+        [OP_LD_DT] = &&op_ld_dt, [OP_LD_ST] = &&op_ld_st, [OP_ADD_I] = &&op_add_i,
+        [OP_LD_F] = &&op_ld_f, [OP_BCD] = &&op_bcd, [OP_STORE] = &&op_store, [OP_LOAD] = &&op_load,
+        [OP_ILLEGAL] = &&op_illegal
+    };
+    if (vm->profile) {
+        profile_exec(vm, count);
+        return;
+    }
+    Inst scratch;
+    Inst* inst;
+    uint32_t n = 0;
+    // Idle loop detection, see LoopState. Since the last backward jump: read the timer or keys,
+    // changed memory, the screen or the timers.
+    LoopState seen = { .pc = MEMORY_SIZE };
+    bool polled = false;
+    bool touched = false;
+
+#define DISPATCH() \
+    if (n == count) goto done; \
+    n++; \
+    inst = fetch_decoded(vm, &scratch); \
+    debug_inst(vm->pc, op_names[inst->op], *inst); \
+    vm->pc += 2; \
+    goto *labels[inst->op]
+
+    DISPATCH();
+    op_cls: clear_screen(inst, vm); touched = true; DISPATCH();
+    op_ret: subroutine_return(inst, vm); DISPATCH();
+    op_jp: {
+        bool back = inst->nnn < vm->pc;
+        bool self = inst->nnn + 2 == vm->pc;
+        jump(inst, vm);
+        if (self) {
+            // Jumps to itself for the rest of the batch, the usual way for a ROM to stop
+            n = count;
+        } else if (back) {
+            if (polled && !touched)
+                n += idle_trips(vm, &seen, n, count - n);
+            else
+                seen.pc = MEMORY_SIZE;
+            polled = false;
+            touched = false;
+        }
+        DISPATCH();
+    }
+    op_call: subroutine_call(inst, vm); DISPATCH();
+    op_se: skip_equal(inst, vm); DISPATCH();
+    op_sne: skip_not_equal(inst, vm); DISPATCH();
+    op_sve: skip_registers_equal(inst, vm); DISPATCH();
+    op_ld_v: load_v(inst, vm); DISPATCH();
+    op_add: add(inst, vm); DISPATCH();
+    op_mov: math_load(inst, vm); DISPATCH();
+    op_or: math_or(inst, vm); DISPATCH();
+    op_and: math_and(inst, vm); DISPATCH();
+    op_xor: math_xor(inst, vm); DISPATCH();
+    op_add_v: math_add(inst, vm); DISPATCH();
+    op_sub: math_sub(inst, vm); DISPATCH();
+    op_shr: math_shr(inst, vm); DISPATCH();
+    op_subn: math_subn(inst, vm); DISPATCH();
+    op_shl: math_shl(inst, vm); DISPATCH();
+    op_svne: skip_registers_not_equal(inst, vm); DISPATCH();
+    op_ld_i: load_i(inst, vm); DISPATCH();
+    op_jp_v0: jump_offset(inst, vm); DISPATCH();
+    op_rnd: rnd(inst, vm); DISPATCH();
+    op_drw: draw(inst, vm); touched = true; DISPATCH();
+    op_skp: skip_key_pressed(inst, vm); polled = true; DISPATCH();
+    op_sknp: skip_key_not_pressed(inst, vm); polled = true; DISPATCH();
+    op_ld_vdt: load_delay(inst, vm); polled = true; DISPATCH();
+    op_ld_k: {
+        uint16_t next = vm->pc;
+        wait_key(inst, vm);
+        // Still waiting. The keys can't change before the batch ends, the rest of it would be spent here
+        if (vm->pc != next)
+            n = count;
+        DISPATCH();
+    }
+    op_ld_dt: set_delay(inst, vm); touched = true; DISPATCH();
+    op_ld_st: set_sound(inst, vm); touched = true; DISPATCH();
+    op_add_i: add_i(inst, vm); DISPATCH();
+    op_ld_f: load_font(inst, vm); DISPATCH();
+    op_bcd: store_bcd(inst, vm); touched = true; DISPATCH();
+    op_store: store_registers(inst, vm); touched = true; DISPATCH();
+    op_load: load_registers(inst, vm); DISPATCH();
+    op_illegal: illegal(inst, vm); DISPATCH();
+#undef DISPATCH
+
+done:
+    vm->instructions += count;
+}
+
+#else
+
+/*
+ * Runs a batch of `count` instructions back to back.
+ */
+void VM_exec(VM* vm, uint32_t count) {
+    if (vm->profile) {
+        profile_exec(vm, count);
+        return;
+    }
+    for (uint32_t n = 0; n < count; n++)
+        step(vm);
+    vm->instructions += count;
+}
 
-            if (!Keyboard_process_input(vm->io->keyboard))
-                return;
+#endif
 
-            Display_render(vm->io->display);
-            next_draw = ticks + 17;  // 60 fps;
+VM* VM_init() {
+    VM* vm = calloc(1, sizeof(VM));
+    memcpy(vm->memory, fonts, 5 * 16);
+    vm->display.dirty = DISPLAY_ALL_ROWS;  // so front ends present the blank screen once
+    VM_seed(vm, 0);
+    return vm;
+}
+
+// Every VM has its own random number generator, 0 picks the default seed
+void VM_seed(VM* vm, uint32_t seed) {
+    vm->rng = seed ? seed : 0x2545F491;
+}
+
+void VM_free(VM* vm) {
+    free(vm);
+}
+
+int16_t VM_load_rom(VM* vm, char* fpath) {
+    FILE* fd = fopen(fpath, "r");
+    if (fd == NULL)
+        return -1;
+
+    uint8_t* data = calloc(MAX_PROGRAM_SIZE, 1);
+    uint16_t size = fread(data, 1, MAX_PROGRAM_SIZE, fd);
+
+    VM_load(vm, data, size);
+    free(data);
+    fclose(fd);
+    return size;
+}
+
+void VM_load(VM* vm, const uint8_t* rom, uint16_t size) {
+    if (size > MAX_PROGRAM_SIZE)
+        size = MAX_PROGRAM_SIZE;
+    memcpy(vm->memory + PROGRAM_START_ADDR, rom, size);
+    VM_flush_cache(vm);
+    vm->pc = PROGRAM_START_ADDR;
+}
+
+/*
+ * Back to the state after VM_init and VM_load, with `memory` the memory it had then (e.g. a
+ * copy of a freshly loaded VM's). Only bytes that differ are written, so decoded instructions
+ * the program didn't overwrite stay cached. The random number generator carries on, VM_seed
+ * it again for a reproducible run.
+ */
+void VM_reset(VM* vm, const uint8_t* memory) {
+    VM_write_memory(vm, memory);
+    memset(vm->v, 0, sizeof(vm->v));
+    memset(vm->stack, 0, sizeof(vm->stack));
+    memset(&vm->display, 0, sizeof(vm->display));
+    vm->display.dirty = DISPLAY_ALL_ROWS;
+    vm->i = 0;
+    vm->delay = 0;
+    vm->sound = 0;
+    vm->pc = PROGRAM_START_ADDR;
+    vm->sp = 0;
+    vm->keyboard.keys = 0;
+    vm->instructions = 0;
+    vm->frames = 0;
+    vm->halted = false;
+    vm->key_wait = 0;
+    vm->cycle_debt = 0;
+}
+
+void PixelLUT_init(PixelLUT lut, uint32_t off, uint32_t on) {
+    for (int byte = 0; byte < 256; byte++) {
+        for (int bit = 0; bit < 8; bit++)
+            lut[byte][bit] = byte >> (7 - bit) & 1 ? on : off;
+    }
+}
+
+/*
+ * Expands rows top to bottom to 32-bit pixels, 8 pixels per table lookup. `pixels` points at
+ * row `top` and `pitch` is the number of bytes between rows.
+ */
+void Display_expand(const Display* display, const PixelLUT lut, void* pixels, int pitch, int top, int bottom) {
+    for (int y = top; y <= bottom; y++) {
+        uint64_t row = display->rows[y];
+        uint32_t* out = (uint32_t*)((uint8_t*)pixels + (y - top) * pitch);
+        for (int b = 0; b < SCREEN_WIDTH / 8; b++)
+            memcpy(out + b * 8, lut[row >> (56 - b * 8) & 0xFF], 8 * sizeof(uint32_t));
+    }
+}
+
+// True while the VM can only wait at FX0A for a key, with both timers run out
+bool VM_waiting_for_key(VM* vm) {
+    return (read_opcode(vm, vm->pc) & 0xF0FF) == 0xF00A && !vm->keyboard.keys && !vm->key_wait &&
+        !vm->delay && !vm->sound && !vm->halted;
+}
+
+// FNV-1a over the framebuffer rows, most significant byte first
+uint64_t Display_hash(const Display* display) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        for (int b = 0; b < 8; b++) {
+            hash ^= (display->rows[y] >> (56 - b * 8)) & 0xFF;
+            hash *= 0x100000001B3ULL;
         }
     }
+    return hash;
+}
+
+void VM_tick_timers(VM* vm) {
+    if (vm->delay > 0)
+        vm->delay -= 1;
+    if (vm->sound > 0)
+        vm->sound -= 1;
+    vm->frames++;
+}
+
+/*
+ * Instructions to run in the current frame to average `ips` per second. Frames get ips / 60
+ * rounded down or up so that the first n frames always add up to ips * n / 60.
+ */
+uint32_t VM_frame_instructions(VM* vm, uint32_t ips) {
+    return (vm->frames + 1) * ips / FRAME_RATE - vm->frames * ips / FRAME_RATE;
+}
+
+void Keyboard_set(Keyboard* keyboard, uint8_t key, bool down) {
+    if (down)
+        keyboard->keys |= 1 << (key & 0x0F);
+    else
+        keyboard->keys &= ~(1 << (key & 0x0F));
 }
@@ -3,18 +3,108 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-#include "io.h"
 
-#define MEMORY_SIZE 0xFFF
+#define MEMORY_SIZE 0x1000
+#define ADDR_MASK 0x0FFF
 #define PROGRAM_START_ADDR 0x200
 #define MAX_PROGRAM_SIZE MEMORY_SIZE - PROGRAM_START_ADDR
+#define STACK_SIZE 16
 
+#define FRAME_RATE 60  // timers count down once per frame
+
+#define SCREEN_WIDTH 64
+#define SCREEN_HEIGHT 32
+#define BUFFER_SIZE SCREEN_WIDTH * SCREEN_HEIGHT
+
+// Every distinct instruction, sub-operations of the 0x0, 0x8, 0xE and 0xF families included
+typedef enum {
+    OP_ILLEGAL = 0,
+    OP_CLS, OP_RET, OP_JP, OP_CALL, OP_SE, OP_SNE, OP_SVE, OP_LD_V, OP_ADD,
+    OP_MOV, OP_OR, OP_AND, OP_XOR, OP_ADD_V, OP_SUB, OP_SHR, OP_SUBN, OP_SHL,
+    OP_SVNE, OP_LD_I, OP_JP_V0, OP_RND, OP_DRW, OP_SKP, OP_SKNP,
+    OP_LD_VDT, OP_LD_K, OP_LD_DT, OP_LD_ST, OP_ADD_I, OP_LD_F, OP_BCD, OP_STORE, OP_LOAD,
+    OP_COUNT
+} Op;
+
+// A decoded instruction. Operands are extracted once so handlers don't re-mask the opcode.
 typedef struct {
     uint16_t opcode;
     uint8_t family;
+    uint8_t op;     // Op
+    uint8_t x;      // 0x_X__
+    uint8_t y;      // 0x__Y_
+    uint8_t n;      // 0x___N
+    uint8_t nn;     // 0x__NN
+    uint16_t nnn;   // 0x_NNN
 } Inst;
 
-typedef struct{
+#define DISPLAY_ALL_ROWS 0xFFFFFFFFu
+
+/*
+ * Framebuffer state, one bit per pixel and one word per row. Bit 63 is the leftmost pixel so a
+ * sprite row is placed with a single shift. Front ends decide how to present it.
+ */
+typedef struct {
+    uint64_t rows[SCREEN_HEIGHT];
+    uint32_t dirty;  // bit y is set when row y changed since the last VM_run present
+} Display;
+
+/*
+ * Predecoded instructions, one entry per address since instructions may start on odd addresses.
+ * Entries are dropped by VM_write when either of their bytes changes. Hits count interpreter
+ * fetches only, misses also the lookups of translators. Idle loops skipped and translated code
+ * execute instructions without fetching them.
+ */
+typedef struct {
+    Inst entries[MEMORY_SIZE];
+    uint8_t valid[MEMORY_SIZE];
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidations;
+    // Range of invalidated addresses, for translators that check it and reset it themselves
+    uint16_t dirty_lo;
+    uint16_t dirty_hi;
+} DecodeCache;
+
+// Host side phases of VM_run, timed while profiling or tracing
+typedef enum {
+    PHASE_EXEC, PHASE_TIMERS, PHASE_AUDIO, PHASE_INPUT, PHASE_RENDER, PHASE_SLEEP, PHASE_RUN_AHEAD,
+    PHASE_COUNT
+} Phase;
+
+/*
+ * Counters kept while vm->profile is set. VM_exec then interprets one instruction at a time
+ * through the handlers table whatever the dispatch engine, so with profiling off the only cost
+ * is one test per batch. Translated code (JIT, AOT, lockstep vectors) isn't counted.
+ */
+typedef struct {
+    uint64_t families[16];        // by top nibble of the opcode
+    uint64_t ops[OP_COUNT];       // by Op, which splits 8XYN, EXNN and FXNN by their low bits
+    uint64_t pcs[MEMORY_SIZE];    // by address the instruction was fetched from
+    uint64_t draws;               // DXYN executed
+    uint64_t collisions;          // DXYN that set VF
+    uint64_t phase_ns[PHASE_COUNT];
+} Profile;
+
+/*
+ * What instructions cost on a COSMAC VIP, in machine cycles of 8 clocks at 1.76 MHz, for
+ * VM_exec_frame. Each 60hz frame gets a budget of `frame` cycles, what's left of the VIP's 3668
+ * once the display interrupt and the CDP1861's DMA took theirs.
+ */
+typedef struct {
+    uint32_t op[OP_COUNT];  // by Op, on top of fetch
+    uint32_t fetch;         // fetching and decoding any instruction
+    uint32_t draw_row;      // DXYN, for every row of the sprite
+    uint32_t frame;
+    bool vblank;            // DXYN waits for the next frame to start drawing, ending the current one
+} CycleCosts;
+
+// The 16 key hex keypad, bit k of keys is set while key k is held
+typedef struct {
+    uint16_t keys;
+} Keyboard;
+
+typedef struct {
     uint8_t memory[MEMORY_SIZE];
     // v0-f are general purpose 8-bit registers. The vf register is somewhat special as
     // it is used as a flag by some instructions.
@@ -26,14 +116,50 @@ typedef struct{
     uint8_t delay;
     uint8_t sound;
     uint16_t pc;   // program counter
-    uint8_t sp;    // stack pointer
-    IO* io;
+    uint8_t sp;    // stack pointer (number of return addresses on the stack)
+    uint16_t stack[STACK_SIZE];
+    Display display;
+    Keyboard keyboard;
+    uint64_t instructions;  // total instructions executed
+    uint64_t frames;        // 60hz frames elapsed, counted by VM_tick_timers
+    uint32_t rng;           // xorshift state for CXNN, see VM_seed
+    bool halted;            // hit an illegal instruction, pc points at it
+    uint8_t key_wait;       // FX0A: 1 + the key it waits to see released, 0 until one is pressed
+    uint32_t cycle_debt;    // cycles VM_exec_frame overran the last frame's budget by
+    // Everything above is machine state, see VM_clone. The cache below is derived from memory.
+    DecodeCache cache;
+    Profile* profile;       // NULL unless profiling, owned by the caller
 } VM;
 
+// Colors of the 8 pixels of every possible byte of a row, built for a palette by PixelLUT_init
+typedef uint32_t PixelLUT[256][8];
+
+typedef void (*Handler)(Inst* inst, VM* vm);
+
+extern Handler handlers[OP_COUNT];
+extern const char* op_names[OP_COUNT];
+extern const CycleCosts vip_costs;
+
 VM* VM_init();
 void VM_free(VM* vm);
+void VM_seed(VM* vm, uint32_t seed);
 int16_t VM_load_rom(VM* vm, char* fpath);
+void VM_load(VM* vm, const uint8_t* rom, uint16_t size);
+void VM_reset(VM* vm, const uint8_t* memory);
+void VM_decode(Inst* inst, uint16_t opcode);
+void VM_write(VM* vm, uint16_t addr, uint8_t value);
+void VM_write_memory(VM* vm, const uint8_t* memory);
+void VM_flush_cache(VM* vm);
+Inst* VM_decode_at(VM* vm, uint16_t addr);
 void VM_tick(VM* vm);
-void VM_run(VM* vm);
+void VM_exec(VM* vm, uint32_t count);
+void VM_exec_frame(VM* vm, const CycleCosts* costs);
+void VM_tick_timers(VM* vm);
+uint32_t VM_frame_instructions(VM* vm, uint32_t ips);
+bool VM_waiting_for_key(VM* vm);
+void Keyboard_set(Keyboard* keyboard, uint8_t key, bool down);
+void PixelLUT_init(PixelLUT lut, uint32_t off, uint32_t on);
+uint64_t Display_hash(const Display* display);
+void Display_expand(const Display* display, const PixelLUT lut, void* pixels, int pitch, int top, int bottom);
 
 #endif